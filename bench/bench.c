@@ -0,0 +1,208 @@
+/**
+ * @file   bench.c
+ *
+ * <EN>
+ * @brief  Benchmark of output_json.c on synthetic results
+ *
+ * Usage: bench [-n records] [-b nbest] [-w words] [-p phones]
+ *              [-s processes] [-v vocab] [-i interim] [-a]
+ *              [-u phoneme|state] [-g nodes] [-c slots] [-d words]
+ *              [-e engines] [-m interval] [-M bytes] [-o file]
+ *              [-j "json options"]
+ *
+ * Drives the callbacks of the plugin for @a records utterances and
+ * reports records per second, nanoseconds per output word, bytes per
+ * record and allocations per record.  With -a and -u, sentences have
+ * word alignments and phoneme or state alignments.  With -g and -c, each process
+ * also has a word graph of that many nodes and a confusion network of
+ * that many slots.  With -d, hypotheses other than the best differ
+ * from it in only that many words.  With -e, the records are split
+ * among that many engines, each on a thread of its own.  With -m, the run is a soak test
+ * of one engine: the bytes the plugin holds are reported every
+ * @a interval utterances, and bench fails if they grow by more than
+ * -M bytes (default 65536) after the first two intervals.  Records go
+ * to a temporary file unless -o is given, and -j passes options to
+ * "-json".  What the plugin prints on stdout is discarded.
+ * </EN>
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "fixture.h"
+
+/* an engine and the utterances it is to run */
+typedef struct {
+  Recog *recog;
+  FixtureConf conf;
+  long records;
+  double words;
+  FixtureSoak *soak;		///< soak test, or NULL
+  pthread_t thread;
+} BenchEngine;
+
+static double
+now_sec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(char *prog)
+{
+  fprintf(stderr, "usage: %s [-n records] [-b nbest] [-w words] [-p phones] [-s processes] [-v vocab] [-i interim] [-a] [-u phoneme|state] [-g nodes] [-c slots] [-d words] [-e engines] [-m interval] [-M bytes] [-o file] [-j \"json options\"]\n", prog);
+  exit(1);
+}
+
+static void *
+bench_run(void *arg)
+{
+  BenchEngine *b = arg;
+  long i;
+
+  for(i=0;i<b->records;i++) {
+    fixture_next(b->recog, &(b->conf));
+    b->words += fixture_utterance(b->recog, &(b->conf));
+    if (b->soak != NULL) fixture_soak_utterance(b->soak);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  FixtureConf conf = { 5000, 5, 12, 5, 1, FALSE, 0, 0, 0, 0, 0, 1 };
+  BenchEngine *engine;
+  FixtureSoak soak;
+  FILE *report;
+  struct stat st;
+  char tmp[] = "/tmp/json-bench-XXXXXX";
+  char *outfile = NULL;
+  char *jsonopt = "";
+  char *args;
+  long records = 100000;
+  long interval = 0;
+  size_t tolerance = 65536;
+  long warmup, i;
+  unsigned long allocs;
+  double words, start, elapsed;
+  off_t size;
+  int engines = 1;
+  int c, k, fd;
+
+  while ((c = getopt(argc, argv, "n:b:w:p:s:v:i:au:g:c:d:e:m:M:o:j:")) != -1) {
+    switch(c) {
+    case 'n': records = atol(optarg); break;
+    case 'b': conf.nbest = atoi(optarg); break;
+    case 'w': conf.words = atoi(optarg); break;
+    case 'p': conf.phones = atoi(optarg); break;
+    case 's': conf.processes = atoi(optarg); break;
+    case 'v': conf.vocab = atoi(optarg); break;
+    case 'i': conf.interim = atoi(optarg); break;
+    case 'a': conf.align = TRUE; break;
+    case 'u':
+      if (strcmp(optarg, "phoneme") == 0) conf.unitalign = PER_PHONEME;
+      else if (strcmp(optarg, "state") == 0) conf.unitalign = PER_STATE;
+      else usage(argv[0]);
+      break;
+    case 'g': conf.graph = atoi(optarg); break;
+    case 'c': conf.confnet = atoi(optarg); break;
+    case 'd': conf.differ = atoi(optarg); break;
+    case 'e': engines = atoi(optarg); break;
+    case 'm': interval = atol(optarg); break;
+    case 'M': tolerance = atol(optarg); break;
+    case 'o': outfile = optarg; break;
+    case 'j': jsonopt = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (records <= 0 || conf.nbest <= 0 || conf.processes <= 0 || engines <= 0) usage(argv[0]);
+  if (interval < 0 || (interval > 0 && engines > 1)) usage(argv[0]);
+
+  if (outfile != NULL) {
+    fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  } else {
+    fd = mkstemp(tmp);
+    if (fd >= 0) unlink(tmp);
+  }
+  if (fd < 0) {
+    perror("bench");
+    return 1;
+  }
+
+  /* keep stdout for the report only */
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    perror("bench");
+    return 1;
+  }
+
+  engine = (BenchEngine *)calloc(engines, sizeof(BenchEngine));
+  for(k=0;k<engines;k++) {
+    engine[k].conf = conf;
+    engine[k].conf.seed = conf.seed + k;
+    engine[k].recog = fixture_recog(&(engine[k].conf));
+    engine[k].records = records / engines + (k < records % engines);
+  }
+  initialize();
+  args = (char *)malloc(strlen(jsonopt) + 32);
+  sprintf(args, "fd=%d noprefix %s", fd, jsonopt);
+  if (! fixture_option(engine[0].recog, args)) {
+    fprintf(stderr, "bench: failed to set up the plugin with \"%s\"\n", args);
+    return 1;
+  }
+  for(k=0;k<engines;k++) {
+    if (startup(engine[k].recog) != 0) {
+      fprintf(stderr, "bench: failed to set up the plugin with \"%s\"\n", args);
+      return 1;
+    }
+  }
+  fixture_quiet = TRUE;
+
+  /* let caches and buffers settle before measuring */
+  warmup = (records < 10000) ? records / 10 + 1 : 1000;
+  for(k=0;k<engines;k++) {
+    for(i=0;i<warmup;i++) {
+      fixture_next(engine[k].recog, &(engine[k].conf));
+      fixture_utterance(engine[k].recog, &(engine[k].conf));
+    }
+  }
+  fstat(fd, &st);
+  size = st.st_size;
+  if (interval > 0) {
+    fixture_soak_init(&soak, interval, tolerance, report);
+    engine[0].soak = &soak;
+  }
+  allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED);
+  start = now_sec();
+  if (engines == 1) {
+    bench_run(&(engine[0]));
+  } else {
+    for(k=0;k<engines;k++) pthread_create(&(engine[k].thread), NULL, bench_run, &(engine[k]));
+    for(k=0;k<engines;k++) pthread_join(engine[k].thread, NULL);
+  }
+  elapsed = now_sec() - start;
+  allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED) - allocs;
+  words = 0;
+  for(k=0;k<engines;k++) {
+    words += engine[k].words;
+    fixture_fire(engine[k].recog, CALLBACK_EVENT_STREAM_END);
+  }
+  fstat(fd, &st);
+
+  if (engines > 1) fprintf(report, "engines       %d\n", engines);
+  fprintf(report, "records       %ld\n", records);
+  fprintf(report, "words/record  %.1f\n", words / records);
+  fprintf(report, "elapsed       %.3f s\n", elapsed);
+  fprintf(report, "records/sec   %.0f\n", records / elapsed);
+  fprintf(report, "ns/word       %.1f\n", elapsed * 1e9 / words);
+  fprintf(report, "bytes/record  %.1f\n", (double)(st.st_size - size) / records);
+  fprintf(report, "allocs/record %.3f\n", (double)allocs / records);
+  if (interval > 0) fprintf(report, "peak bytes    %lu\n", (unsigned long)fixture_peak_bytes);
+  if (interval > 0 && ! fixture_soak_check(&soak)) return 1;
+  return 0;
+}
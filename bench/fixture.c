@@ -0,0 +1,596 @@
+/**
+ * @file   fixture.c
+ *
+ * <EN>
+ * @brief  Julius functions and synthetic results for the benchmark
+ *
+ * Implements the few libjulius functions output_json.c calls, counts
+ * the allocations it makes and the bytes it holds, and builds a Recog
+ * with a synthetic dictionary and N-best results whose shape is given
+ * by FixtureConf.
+ * fixture_utterance() then fires the callbacks in the order Julius
+ * does for one utterance.
+ * </EN>
+ */
+
+#include "fixture.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+static boolean (*option_func)(Jconf *jconf, char *arg[], int argnum) = NULL;
+
+unsigned long fixture_allocs = 0;
+unsigned long fixture_frees = 0;
+size_t fixture_alloc_bytes = 0;
+size_t fixture_live_bytes = 0;
+size_t fixture_peak_bytes = 0;
+boolean fixture_quiet = FALSE;
+char *fixture_filename = "synthetic.wav";
+
+int
+callback_add(Recog *recog, int code, void (*func)(Recog *recog, void *data), void *data)
+{
+  int n = recog->callback_function_num[code];
+
+  if (n >= MAX_CALLBACK_HOOK) return -1;
+  recog->callback_function[code][n] = func;
+  recog->callback_user_param[code][n] = data;
+  return recog->callback_function_num[code]++;
+}
+
+boolean
+j_add_option(char *fmt, int argnum, int reqargnum, char *desc, boolean (*func)(Jconf *jconf, char *arg[], int argnum))
+{
+  option_func = func;
+  return TRUE;
+}
+
+void
+jlog(char *fmt, ...)
+{
+  va_list ap;
+
+  if (fixture_quiet) return;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+/* "a-b+c" to "b", as libsent does */
+char *
+center_name(char *hmmname, char *buf)
+{
+  char *p;
+
+  p = strchr(hmmname, '-');
+  strcpy(buf, (p != NULL) ? p + 1 : hmmname);
+  p = strchr(buf, '+');
+  if (p != NULL) *p = '\0';
+  return buf;
+}
+
+/* each block starts with its size, to count the bytes live */
+#define FIXTURE_HEADER 16
+
+/* count @a n more bytes live, or fewer when negative */
+static void
+fixture_count(long n)
+{
+  size_t live, peak;
+
+  live = __atomic_add_fetch(&fixture_live_bytes, n, __ATOMIC_RELAXED);
+  peak = __atomic_load_n(&fixture_peak_bytes, __ATOMIC_RELAXED);
+  while (live > peak && ! __atomic_compare_exchange_n(&fixture_peak_bytes, &peak, live, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void *
+mymalloc(size_t size)
+{
+  char *p;
+
+  __atomic_fetch_add(&fixture_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&fixture_alloc_bytes, size, __ATOMIC_RELAXED);
+  p = (char *)malloc(size + FIXTURE_HEADER);
+  *(size_t *)p = size;
+  fixture_count(size);
+  return p + FIXTURE_HEADER;
+}
+
+void *
+myrealloc(void *ptr, size_t size)
+{
+  char *p;
+  size_t old;
+
+  if (ptr == NULL) return mymalloc(size);
+  __atomic_fetch_add(&fixture_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&fixture_alloc_bytes, size, __ATOMIC_RELAXED);
+  p = (char *)ptr - FIXTURE_HEADER;
+  old = *(size_t *)p;
+  p = (char *)realloc(p, size + FIXTURE_HEADER);
+  *(size_t *)p = size;
+  fixture_count((long)size - (long)old);
+  return p + FIXTURE_HEADER;
+}
+
+void
+myfree(void *ptr)
+{
+  char *p;
+
+  if (ptr == NULL) return;
+  __atomic_fetch_add(&fixture_frees, 1, __ATOMIC_RELAXED);
+  p = (char *)ptr - FIXTURE_HEADER;
+  fixture_count(-(long)*(size_t *)p);
+  free(p);
+}
+
+/**
+ * Bytes in use by malloc() in the whole process, including what the
+ * C library and others allocate for the plugin outside mymalloc(), or
+ * 0 when the C library cannot tell.
+ */
+size_t
+fixture_heap_bytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Start a soak test: the bytes live are watched over windows of
+ * @a interval utterances, and progress is reported to @a fp at the
+ * end of each.  The first window lets the caches of the plugin fill
+ * up, and the second sets the steady state.
+ */
+void
+fixture_soak_init(FixtureSoak *s, long interval, size_t tolerance, FILE *fp)
+{
+  memset(s, 0, sizeof(FixtureSoak));
+  s->interval = interval;
+  s->tolerance = tolerance;
+  s->fp = fp;
+  s->min = (size_t)-1;
+  s->allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED);
+}
+
+/* call after each utterance */
+void
+fixture_soak_utterance(FixtureSoak *s)
+{
+  size_t live = __atomic_load_n(&fixture_live_bytes, __ATOMIC_RELAXED);
+  unsigned long allocs;
+
+  if (live < s->min) s->min = live;
+  if (live > s->max) s->max = live;
+  if (++s->utterances % s->interval != 0) return;
+
+  allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED);
+  s->windows++;
+  s->last = s->min;
+  s->heap_last = fixture_heap_bytes();
+  if (s->windows == 2) {
+    s->base = s->max;
+    s->heap_base = s->heap_last;
+  }
+  fprintf(s->fp, "utterances %ld live %lu..%lu peak %lu heap %lu allocs/utterance %.3f\n",
+	  s->utterances, (unsigned long)s->min, (unsigned long)s->max,
+	  (unsigned long)__atomic_load_n(&fixture_peak_bytes, __ATOMIC_RELAXED),
+	  (unsigned long)s->heap_last, (double)(allocs - s->allocs) / s->interval);
+  fflush(s->fp);
+  s->min = (size_t)-1;
+  s->max = 0;
+  s->allocs = allocs;
+}
+
+/**
+ * Tell whether the memory stayed steady: the fewest bytes live in the
+ * last window, and the bytes in use by malloc() at its end, must not
+ * exceed those of the steady state by more than the tolerance.
+ */
+boolean
+fixture_soak_check(FixtureSoak *s)
+{
+  boolean ok = TRUE;
+
+  if (s->windows < 3) {
+    fprintf(s->fp, "soak: too few utterances for 3 windows of %ld\n", s->interval);
+    return FALSE;
+  }
+  if (s->last > s->base + s->tolerance) {
+    fprintf(s->fp, "soak: FAIL: live bytes grew from %lu to %lu\n", (unsigned long)s->base, (unsigned long)s->last);
+    ok = FALSE;
+  }
+  if (s->heap_last > s->heap_base + s->tolerance) {
+    fprintf(s->fp, "soak: FAIL: heap grew from %lu to %lu\n", (unsigned long)s->heap_base, (unsigned long)s->heap_last);
+    ok = FALSE;
+  }
+  if (ok) fprintf(s->fp, "soak: OK: live bytes %lu, heap %lu in steady state\n", (unsigned long)s->last, (unsigned long)s->heap_last);
+  return ok;
+}
+
+char *
+j_get_current_filename(Recog *recog)
+{
+  return fixture_filename;
+}
+
+#ifdef CHARACTER_CONVERSION
+/* no "-charconv": the text goes out as it is */
+char *
+charconv(char *instr, char *outstr, int maxoutlen)
+{
+  return instr;
+}
+#endif
+
+/* give the "-json" arguments, separated by spaces */
+boolean
+fixture_option(Recog *recog, char *args)
+{
+  char *arg[64];
+  char *p;
+  int n;
+
+  if (option_func == NULL) return FALSE;
+  n = 0;
+  /* the plugin may keep pointers into the arguments */
+  for(p=strtok(strdup(args), " ");p && n < 64;p=strtok(NULL, " ")) arg[n++] = p;
+  return option_func(recog->jconf, arg, n);
+}
+
+void
+fixture_fire(Recog *recog, int code)
+{
+  int i;
+
+  for(i=0;i<recog->callback_function_num[code];i++) {
+    recog->callback_function[code][i](recog, recog->callback_user_param[code][i]);
+  }
+}
+
+static unsigned int
+fixture_rand(unsigned int *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) & 0x7fff;
+}
+
+static const char *phone_set[] = {
+  "a", "i", "u", "e", "o", "k", "s", "t", "n", "h", "m", "y", "r", "w", "N",
+  "g", "z", "d", "b", "p", "ch", "sh", "ts", "j", "f", "q", "ky", "ny"
+};
+#define PHONE_SET_NUM (sizeof(phone_set) / sizeof(phone_set[0]))
+
+static HMM_Logical *
+fixture_hmm(const char *name)
+{
+  HMM_Logical *h;
+
+  h = (HMM_Logical *)calloc(1, sizeof(HMM_Logical));
+  h->name = strdup(name);
+  h->body.defined = (HTK_HMM_Data *)calloc(1, sizeof(HTK_HMM_Data));
+  h->body.defined->name = h->name;
+  h->body.defined->state_num = 5;
+  return h;
+}
+
+/* dictionary of conf->vocab words: <s>, </s>, then synthetic words */
+static WORD_INFO *
+fixture_dict(FixtureConf *conf)
+{
+  WORD_INFO *winfo;
+  char buf[MAX_HMMNAME_LEN];
+  const char *l, *c, *r;
+  unsigned int seed = 1;
+  int w, j, n;
+
+  winfo = (WORD_INFO *)calloc(1, sizeof(WORD_INFO));
+  n = (conf->vocab < 3) ? 3 : conf->vocab;
+  winfo->num = winfo->maxnum = n;
+  winfo->wlen = (unsigned char *)calloc(n, sizeof(unsigned char));
+  winfo->wname = (char **)calloc(n, sizeof(char *));
+  winfo->woutput = (char **)calloc(n, sizeof(char *));
+  winfo->wseq = (HMM_Logical ***)calloc(n, sizeof(HMM_Logical **));
+
+  winfo->wname[0] = "<s>";
+  winfo->woutput[0] = "";
+  winfo->wlen[0] = 1;
+  winfo->wseq[0] = (HMM_Logical **)calloc(1, sizeof(HMM_Logical *));
+  winfo->wseq[0][0] = fixture_hmm("silB");
+  winfo->wname[1] = "</s>";
+  winfo->woutput[1] = "。";
+  winfo->wlen[1] = 1;
+  winfo->wseq[1] = (HMM_Logical **)calloc(1, sizeof(HMM_Logical *));
+  winfo->wseq[1][0] = fixture_hmm("silE");
+
+  for(w=2;w<n;w++) {
+    snprintf(buf, sizeof(buf), "単語%d+名詞", w);
+    winfo->wname[w] = strdup(buf);
+    snprintf(buf, sizeof(buf), "単語%d", w);
+    winfo->woutput[w] = strdup(buf);
+    winfo->wlen[w] = (conf->phones < 1) ? 1 : (conf->phones > 255) ? 255 : conf->phones;
+    winfo->wseq[w] = (HMM_Logical **)calloc(winfo->wlen[w], sizeof(HMM_Logical *));
+    l = phone_set[fixture_rand(&seed) % PHONE_SET_NUM];
+    c = phone_set[fixture_rand(&seed) % PHONE_SET_NUM];
+    for(j=0;j<winfo->wlen[w];j++) {
+      r = phone_set[fixture_rand(&seed) % PHONE_SET_NUM];
+      /* context dependent names, "-" and "+" at the word edges */
+      if (j == 0 && winfo->wlen[w] == 1) snprintf(buf, sizeof(buf), "%s", c);
+      else if (j == 0) snprintf(buf, sizeof(buf), "%s+%s", c, r);
+      else if (j == winfo->wlen[w] - 1) snprintf(buf, sizeof(buf), "%s-%s", l, c);
+      else snprintf(buf, sizeof(buf), "%s-%s+%s", l, c, r);
+      winfo->wseq[w][j] = fixture_hmm(buf);
+      l = c;
+      c = r;
+    }
+  }
+  return winfo;
+}
+
+/* arcs from each node of the word graph to the next ones */
+#define FIXTURE_GRAPH_ARCS 3
+
+/* a word graph of @a num nodes, to be filled by fixture_next() */
+static WordGraph *
+fixture_graph(int num)
+{
+  WordGraph *wg;
+  int i, j;
+
+  wg = (WordGraph *)calloc(num, sizeof(WordGraph));
+  for(i=0;i<num;i++) {
+    wg[i].id = i;
+    wg[i].next = (i + 1 < num) ? &(wg[i + 1]) : NULL;
+    wg[i].rightword = (WordGraph **)calloc(FIXTURE_GRAPH_ARCS, sizeof(WordGraph *));
+    for(j=0;j<FIXTURE_GRAPH_ARCS && i+1+j<num;j++) wg[i].rightword[j] = &(wg[i + 1 + j]);
+    wg[i].rightwordnum = j;
+  }
+  return wg;
+}
+
+/* states of each phone in a state alignment */
+#define FIXTURE_ALIGN_STATES 3
+
+/* a phoneme or state alignment of up to @a num units */
+static SentenceAlign *
+fixture_align(int unittype, int num)
+{
+  SentenceAlign *a;
+
+  a = (SentenceAlign *)calloc(1, sizeof(SentenceAlign));
+  a->unittype = unittype;
+  a->ph = (HMM_Logical **)calloc(num, sizeof(HMM_Logical *));
+  a->loc = (short *)calloc(num, sizeof(short));
+  a->begin_frame = (int *)calloc(num, sizeof(int));
+  a->end_frame = (int *)calloc(num, sizeof(int));
+  a->avgscore = (LOGPROB *)calloc(num, sizeof(LOGPROB));
+  return a;
+}
+
+/* competing words in each slot of the confusion network */
+#define FIXTURE_CONFNET_WORDS 4
+
+/* a confusion network of @a num slots, to be filled by fixture_next() */
+static CN_CLUSTER *
+fixture_confnet(int num)
+{
+  CN_CLUSTER *c;
+  int i;
+
+  c = (CN_CLUSTER *)calloc(num, sizeof(CN_CLUSTER));
+  for(i=0;i<num;i++) {
+    c[i].next = (i + 1 < num) ? &(c[i + 1]) : NULL;
+    c[i].wseq = (WORD_ID *)calloc(FIXTURE_CONFNET_WORDS, sizeof(WORD_ID));
+    c[i].pp = (LOGPROB *)calloc(FIXTURE_CONFNET_WORDS, sizeof(LOGPROB));
+  }
+  return c;
+}
+
+Recog *
+fixture_recog(FixtureConf *conf)
+{
+  Recog *recog;
+  RecogProcess *r, **rp;
+  WORD_INFO *winfo;
+  SentenceAlign *a;
+  int i, n;
+
+  recog = (Recog *)calloc(1, sizeof(Recog));
+  recog->jconf = (Jconf *)calloc(1, sizeof(Jconf));
+  recog->jconf->input.period = 625;	/* 16kHz */
+  recog->jconf->input.frameshift = 160;
+  recog->mfcclist = (MFCCCalc *)calloc(1, sizeof(MFCCCalc));
+  recog->mfcclist->param = (HTK_Param *)calloc(1, sizeof(HTK_Param));
+  recog->gc = (GMMCalc *)calloc(1, sizeof(GMMCalc));
+  recog->gc->max_d = (GMMData *)calloc(1, sizeof(GMMData));
+  recog->gc->max_d->name = "speech";
+
+  if (conf->words > MAXSEQNUM) conf->words = MAXSEQNUM;
+  if (conf->words < 2) conf->words = 2;
+  winfo = fixture_dict(conf);
+  rp = &(recog->process_list);
+  for(i=0;i<conf->processes;i++) {
+    r = (RecogProcess *)calloc(1, sizeof(RecogProcess));
+    r->live = TRUE;
+    r->config = (JCONF_SEARCH *)calloc(1, sizeof(JCONF_SEARCH));
+    r->config->id = i;
+    snprintf(r->config->name, sizeof(r->config->name), "SR%02d", i);
+    r->lm = (PROCESS_LM *)calloc(1, sizeof(PROCESS_LM));
+    r->lm->winfo = winfo;
+    r->lmtype = LM_PROB;
+    r->result.sent = (Sentence *)calloc(conf->nbest, sizeof(Sentence));
+    if (conf->align) {
+      for(n=0;n<conf->nbest;n++) {
+	a = (SentenceAlign *)calloc(1, sizeof(SentenceAlign));
+	a->unittype = PER_WORD;
+	a->begin_frame = (int *)calloc(MAXSEQNUM, sizeof(int));
+	a->end_frame = (int *)calloc(MAXSEQNUM, sizeof(int));
+	r->result.sent[n].align = a;
+      }
+    }
+    if (conf->unitalign == PER_PHONEME || conf->unitalign == PER_STATE) {
+      for(n=0;n<conf->nbest;n++) {
+	a = fixture_align(conf->unitalign, MAXSEQNUM * 255 * ((conf->unitalign == PER_STATE) ? FIXTURE_ALIGN_STATES : 1));
+	a->next = r->result.sent[n].align;
+	r->result.sent[n].align = a;
+      }
+    }
+    if (conf->graph > 0) r->result.wg = fixture_graph(conf->graph);
+    if (conf->confnet > 0) r->result.confnet = fixture_confnet(conf->confnet);
+    *rp = r;
+    rp = &(r->next);
+  }
+  fixture_next(recog, conf);
+  return recog;
+}
+
+/* fill in the results of the next utterance */
+void
+fixture_next(Recog *recog, FixtureConf *conf)
+{
+  RecogProcess *r;
+  Sentence *s;
+  WORD_INFO *winfo;
+  WordGraph *wg;
+  CN_CLUSTER *c;
+  SentenceAlign *a;
+  LOGPROB sum;
+  int n, i, j, k, states;
+
+  recog->mfcclist->param->samplenum = conf->words * 30;
+  for(r=recog->process_list;r;r=r->next) {
+    winfo = r->lm->winfo;
+    r->result.sentnum = conf->nbest;
+    r->result.num_frame = conf->words * 30;
+    r->result.status = J_RESULT_STATUS_SUCCESS;
+    for(n=0;n<conf->nbest;n++) {
+      s = &(r->result.sent[n]);
+      s->word_num = conf->words;
+      s->word[0] = 0;
+      s->word[conf->words - 1] = 1;
+      if (n > 0 && conf->differ > 0) {
+	/* a few words changed in the best one, as N-best lists are */
+	memcpy(s->word, r->result.sent[0].word, sizeof(WORD_ID) * conf->words);
+	for(i=0;i<conf->differ;i++) s->word[1 + fixture_rand(&(conf->seed)) % (conf->words - 2)] = 2 + fixture_rand(&(conf->seed)) % (winfo->num - 2);
+      } else {
+	for(i=1;i<conf->words-1;i++) s->word[i] = 2 + fixture_rand(&(conf->seed)) % (winfo->num - 2);
+      }
+      for(i=0;i<conf->words;i++) s->confidence[i] = (fixture_rand(&(conf->seed)) % 1000) / 1000.0;
+      s->score = -(float)(conf->words * 750 + fixture_rand(&(conf->seed)) % 1000) - n * 12.5;
+      s->score_am = s->score * 0.9;
+      s->score_lm = s->score * 0.1;
+      for(a=s->align;a;a=a->next) {
+	if (a->unittype == PER_WORD) {
+	  a->num = conf->words;
+	  for(i=0;i<conf->words;i++) {
+	    a->begin_frame[i] = i * 30;
+	    a->end_frame[i] = i * 30 + 29;
+	  }
+	  continue;
+	}
+	/* the 30 frames of each word split among its units */
+	states = (a->unittype == PER_STATE) ? FIXTURE_ALIGN_STATES : 1;
+	a->num = 0;
+	for(i=0;i<conf->words;i++) {
+	  for(j=0;j<winfo->wlen[s->word[i]];j++) {
+	    for(k=0;k<states;k++) {
+	      a->ph[a->num] = winfo->wseq[s->word[i]][j];
+	      a->loc[a->num] = k + 2;
+	      a->begin_frame[a->num] = i * 30 + 30 * (j * states + k) / (winfo->wlen[s->word[i]] * states);
+	      a->end_frame[a->num] = i * 30 + 30 * (j * states + k + 1) / (winfo->wlen[s->word[i]] * states) - 1;
+	      a->avgscore[a->num] = -(float)(fixture_rand(&(conf->seed)) % 4000) / 100.0;
+	      a->num++;
+	    }
+	  }
+	}
+	a->allscore = s->score_am;
+      }
+    }
+    /* words of the graph overlap by a few frames */
+    for(wg=r->result.wg,i=0;wg;wg=wg->next,i++) {
+      wg->wid = (wg->next == NULL) ? 1 : (i == 0) ? 0 : 2 + fixture_rand(&(conf->seed)) % (winfo->num - 2);
+      wg->lefttime = i * 10;
+      wg->righttime = i * 10 + 25;
+      wg->amavg = -(float)(fixture_rand(&(conf->seed)) % 4000) / 100.0;
+      wg->fscore_head = -(float)(i * 250 + fixture_rand(&(conf->seed)) % 100);
+      wg->gscore_tail = -(float)((conf->graph - i) * 250 + fixture_rand(&(conf->seed)) % 100);
+      wg->graph_cm = (fixture_rand(&(conf->seed)) % 1000) / 1000.0;
+    }
+    /* a slot has 1 to 4 words, the last one may skip it */
+    for(c=r->result.confnet;c;c=c->next) {
+      c->wseqnum = 1 + fixture_rand(&(conf->seed)) % FIXTURE_CONFNET_WORDS;
+      sum = 0;
+      for(j=0;j<c->wseqnum;j++) {
+	c->wseq[j] = 2 + fixture_rand(&(conf->seed)) % (winfo->num - 2);
+	c->pp[j] = 1.0 + fixture_rand(&(conf->seed)) % 100;
+	sum += c->pp[j];
+      }
+      if (c->wseqnum > 1 && fixture_rand(&(conf->seed)) % 4 == 0) c->wseq[c->wseqnum - 1] = WORD_INVALID;
+      for(j=0;j<c->wseqnum;j++) c->pp[j] /= sum;
+    }
+  }
+}
+
+/**
+ * Fire the callbacks of one utterance in the order Julius does, and
+ * return the number of words in its results.
+ */
+int
+fixture_utterance(Recog *recog, FixtureConf *conf)
+{
+  RecogProcess *r;
+  Sentence *best = NULL;
+  char str[MAXSEQNUM * 16];
+  char *p;
+  int i, k, words;
+
+  fixture_fire(recog, CALLBACK_EVENT_SPEECH_READY);
+  fixture_fire(recog, CALLBACK_EVENT_SPEECH_START);
+  fixture_fire(recog, CALLBACK_EVENT_PASS1_BEGIN);
+  for(r=recog->process_list;r;r=r->next) r->have_interim = (conf->interim > 0);
+  for(k=1;k<=conf->interim;k++) {
+    /* the best hypothesis grows word by word */
+    for(r=recog->process_list;r;r=r->next) {
+      r->result.pass1 = r->result.sent[0];
+      r->result.pass1.word_num = r->result.sent[0].word_num * k / conf->interim;
+      r->result.num_frame = r->result.pass1.word_num * 30;
+    }
+    fixture_fire(recog, CALLBACK_RESULT_PASS1_INTERIM);
+  }
+  fixture_fire(recog, CALLBACK_EVENT_SPEECH_STOP);
+  for(r=recog->process_list;r;r=r->next) {
+    r->result.pass1 = r->result.sent[0];
+    r->result.num_frame = conf->words * 30;
+  }
+  fixture_fire(recog, CALLBACK_RESULT_PASS1);
+  fixture_fire(recog, CALLBACK_EVENT_PASS1_END);
+  fixture_fire(recog, CALLBACK_STATUS_PARAM);
+  fixture_fire(recog, CALLBACK_RESULT);
+  fixture_fire(recog, CALLBACK_RESULT_GRAPH);
+  fixture_fire(recog, CALLBACK_RESULT_CONFNET);
+  fixture_fire(recog, CALLBACK_RESULT_GMM);
+
+  words = 0;
+  for(r=recog->process_list;r;r=r->next) {
+    if (best == NULL) best = &(r->result.sent[0]);
+    for(i=0;i<r->result.sentnum;i++) words += r->result.sent[i].word_num;
+  }
+  /* the best sentence, as Julius gives it to result_best_str() */
+  p = str;
+  for(i=0;best && i<best->word_num;i++) {
+    if (i > 0) *p++ = ' ';
+    strcpy(p, recog->process_list->lm->winfo->woutput[best->word[i]]);
+    p += strlen(p);
+  }
+  *p = '\0';
+  result_best_str(str);
+  fixture_fire(recog, CALLBACK_EVENT_RECOGNITION_END);
+  return words;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file   fixture.h
+ *
+ * <EN>
+ * @brief  Synthetic Julius results to drive output_json.c with
+ * </EN>
+ */
+
+#ifndef __BENCH_FIXTURE_H__
+#define __BENCH_FIXTURE_H__
+
+#include <julius/juliuslib.h>
+
+/**
+ * Shape of the synthetic results.
+ */
+typedef struct {
+  int vocab;			///< words in the dictionary
+  int nbest;			///< sentences per process
+  int words;			///< words per sentence
+  int phones;			///< phones per word
+  int processes;		///< recognition processes
+  boolean align;		///< word alignment
+  int unitalign;		///< PER_PHONEME or PER_STATE alignment too, or 0
+  int interim;			///< interim results in the 1st pass
+  int graph;			///< nodes of the word graph, 0 for none
+  int confnet;			///< slots of the confusion network, 0 for none
+  int differ;			///< words other hypotheses change in the best, 0 for all
+  unsigned int seed;		///< of the word sequences
+} FixtureConf;
+
+/* plugin entry points of output_json.c */
+extern int initialize();
+extern int startup(void *data);
+extern void result_best_str(char *result_str);
+
+/* allocations through mymalloc() and myrealloc() */
+extern unsigned long fixture_allocs;
+extern unsigned long fixture_frees;
+extern size_t fixture_alloc_bytes;
+extern size_t fixture_live_bytes;	///< allocated and not freed
+extern size_t fixture_peak_bytes;	///< high-water mark of fixture_live_bytes
+
+/**
+ * State of a soak test, which watches the bytes live over windows of
+ * utterances for steady growth.
+ */
+typedef struct {
+  long interval;		///< utterances per window
+  size_t tolerance;		///< bytes the steady state may grow by
+  long utterances;
+  int windows;			///< windows completed
+  size_t min, max;		///< bytes live in the current window
+  size_t base;			///< most bytes live in the steady state
+  size_t last;			///< fewest bytes live in the last window
+  size_t heap_base, heap_last;	///< fixture_heap_bytes() at the same points
+  unsigned long allocs;		///< fixture_allocs at the start of the window
+  FILE *fp;			///< progress and result
+} FixtureSoak;
+
+extern boolean fixture_quiet;
+extern char *fixture_filename;	///< given by j_get_current_filename()
+
+Recog *fixture_recog(FixtureConf *conf);
+boolean fixture_option(Recog *recog, char *args);
+void fixture_fire(Recog *recog, int code);
+void fixture_next(Recog *recog, FixtureConf *conf);
+int fixture_utterance(Recog *recog, FixtureConf *conf);
+size_t fixture_heap_bytes();
+void fixture_soak_init(FixtureSoak *s, long interval, size_t tolerance, FILE *fp);
+void fixture_soak_utterance(FixtureSoak *s);
+boolean fixture_soak_check(FixtureSoak *s);
+
+#endif /* __BENCH_FIXTURE_H__ */
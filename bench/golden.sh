@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Compare the records bench/bench writes for fixed synthetic results
+# with those kept in bench/golden, or rewrite them with -u.  TIME is
+# the only member that differs between runs, and is left out.
+#
+# Usage: bench/golden.sh [-u]
+
+cd `dirname $0`/.. || exit 1
+
+update=
+if [ "$1" = "-u" ]; then
+  update=1
+fi
+
+status=0
+tmp=`mktemp` || exit 1
+trap 'rm -f $tmp $tmp.out' 0
+
+while read name args; do
+  case "$name" in
+  ''|'#'*) continue;;
+  esac
+  eval ./bench/bench -o $tmp $args > /dev/null || {
+    echo "$name: bench failed"
+    status=1
+    continue
+  }
+  sed 's/^{"TIME":{[^}]*},/{/' $tmp > $tmp.out
+  if [ -n "$update" ]; then
+    cp $tmp.out bench/golden/$name.jsonl
+    echo "$name: updated"
+  elif cmp -s $tmp.out bench/golden/$name.jsonl; then
+    echo "$name: ok"
+  else
+    echo "$name: FAIL: records differ from bench/golden/$name.jsonl"
+    status=1
+  fi
+done <<EOF
+# name		bench options
+default		-n 10 -b 2 -w 5 -a
+processes	-n 5 -s 2 -b 2 -w 4 -a -u phoneme
+graph		-n 5 -b 2 -w 4 -a -u state -g 6 -c 3
+shortest	-n 5 -b 3 -w 4 -j "floats=shortest cmdigits=3 scoredigits=1"
+compact		-n 5 -b 3 -w 4 -d 1 -a -j "nbest=compact noslash"
+standard	-n 5 -b 2 -w 4 -a -j "profile=standard"
+EOF
+
+exit $status
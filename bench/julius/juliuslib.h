@@ -0,0 +1,261 @@
+/**
+ * @file   juliuslib.h
+ *
+ * <EN>
+ * @brief  Stand-in for the Julius library header, for the benchmark
+ *
+ * Declares the subset of the Julius 4.5 types and functions that
+ * output_json.c uses, so that the plugin can be built and driven
+ * without a Julius installation.  Structures carry only the members
+ * the plugin reads, and the functions are implemented by fixture.c.
+ * </EN>
+ */
+
+#ifndef __BENCH_JULIUSLIB_H__
+#define __BENCH_JULIUSLIB_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+typedef int boolean;
+#define TRUE 1
+#define FALSE 0
+
+typedef float LOGPROB;
+typedef unsigned short WORD_ID;
+#define WORD_INVALID 65535
+#define MAX_HMMNAME_LEN 256
+#define MAXSEQNUM 150
+
+#ifndef CONFIDENCE_MEASURE
+#define CONFIDENCE_MEASURE
+#endif
+#ifndef USE_MBR
+#define USE_MBR
+#endif
+
+/* language model types */
+enum { LM_UNDEF, LM_PROB, LM_DFA };
+
+/* alignment units */
+enum { PER_WORD, PER_PHONEME, PER_STATE };
+
+/* recognition status */
+#define J_RESULT_STATUS_REJECT_GMM -8
+#define J_RESULT_STATUS_REJECT_LONG -7
+#define J_RESULT_STATUS_BUFFER_OVERFLOW -6
+#define J_RESULT_STATUS_REJECT_POWER -5
+#define J_RESULT_STATUS_TERMINATE -4
+#define J_RESULT_STATUS_ONLY_SILENCE -3
+#define J_RESULT_STATUS_REJECT_SHORT -2
+#define J_RESULT_STATUS_FAIL -1
+#define J_RESULT_STATUS_SUCCESS 0
+
+typedef struct {
+  char *name;
+  short state_num;
+} HTK_HMM_Data;
+
+typedef struct {
+  char *name;
+  short state_num;
+} CD_Set;
+
+typedef struct _HMM_logical {
+  char *name;
+  boolean is_pseudo;
+  union {
+    HTK_HMM_Data *defined;
+    CD_Set *pseudo;
+  } body;
+  struct _HMM_logical *next;
+} HMM_Logical;
+
+typedef struct {
+  WORD_ID maxnum;
+  WORD_ID num;
+  unsigned char *wlen;
+  char **wname;
+  char **woutput;
+  HMM_Logical ***wseq;
+} WORD_INFO;
+
+typedef struct __sentence_align__ {
+  int num;
+  short unittype;
+  WORD_ID *w;
+  HMM_Logical **ph;
+  short *loc;
+  boolean *is_iwsp;
+  int *begin_frame;
+  int *end_frame;
+  LOGPROB *avgscore;
+  LOGPROB allscore;
+  struct __sentence_align__ *next;
+} SentenceAlign;
+
+typedef struct {
+  WORD_ID word[MAXSEQNUM];
+  int word_num;
+  LOGPROB score;
+  LOGPROB confidence[MAXSEQNUM];
+  LOGPROB score_lm;
+  LOGPROB score_am;
+  int gram_id;
+  SentenceAlign *align;
+  LOGPROB score_mbr;
+} Sentence;
+
+typedef struct __word_graph__ {
+  WORD_ID wid;
+  int lefttime;
+  int righttime;
+  LOGPROB fscore_head;
+  LOGPROB fscore_tail;
+  LOGPROB gscore_head;
+  LOGPROB gscore_tail;
+  LOGPROB lscore_tmp;
+  LOGPROB amavg;
+  struct __word_graph__ **leftword;
+  int leftwordnum;
+  struct __word_graph__ **rightword;
+  int rightwordnum;
+  int id;
+  LOGPROB graph_cm;
+  struct __word_graph__ *next;
+} WordGraph;
+
+typedef struct __cn_cluster__ {
+  WORD_ID *wseq;
+  LOGPROB *pp;
+  int wseqnum;
+  struct __cn_cluster__ *next;
+} CN_CLUSTER;
+
+typedef struct {
+  Sentence pass1;
+  Sentence *sent;
+  int sentnum;
+  int num_frame;
+  WordGraph *wg;
+  CN_CLUSTER *confnet;
+  int status;
+} Result;
+
+typedef struct {
+  boolean use_mbr;
+} JCONF_MBR;
+
+typedef struct {
+  short id;
+  char name[64];
+  JCONF_MBR mbr;
+} JCONF_SEARCH;
+
+typedef struct {
+  WORD_INFO *winfo;
+} PROCESS_LM;
+
+typedef struct __recogprocess__ {
+  boolean live;
+  boolean have_interim;
+  JCONF_SEARCH *config;
+  PROCESS_LM *lm;
+  int lmtype;
+  Result result;
+  int graph_totalwordnum;
+  struct __recogprocess__ *next;
+} RecogProcess;
+
+typedef struct {
+  int samplenum;
+} HTK_Param;
+
+typedef struct __mfcc_calc__ {
+  short id;
+  HTK_Param *param;
+  struct __mfcc_calc__ *next;
+} MFCCCalc;
+
+typedef struct {
+  int period;
+  int frameshift;
+} JCONF_INPUT;
+
+typedef struct {
+  JCONF_INPUT input;
+} Jconf;
+
+typedef struct {
+  char *name;
+} GMMData;
+
+typedef struct {
+  GMMData *max_d;
+  LOGPROB gmm_max_cm;
+} GMMCalc;
+
+/* callback IDs, in the order of libjulius/include/julius/callback.h */
+enum {
+  CALLBACK_POLL,
+  CALLBACK_EVENT_PROCESS_ONLINE,
+  CALLBACK_EVENT_PROCESS_OFFLINE,
+  CALLBACK_EVENT_STREAM_BEGIN,
+  CALLBACK_EVENT_STREAM_END,
+  CALLBACK_EVENT_SPEECH_READY,
+  CALLBACK_EVENT_SPEECH_START,
+  CALLBACK_EVENT_SPEECH_STOP,
+  CALLBACK_EVENT_RECOGNITION_BEGIN,
+  CALLBACK_EVENT_RECOGNITION_END,
+  CALLBACK_EVENT_SEGMENT_BEGIN,
+  CALLBACK_EVENT_SEGMENT_END,
+  CALLBACK_EVENT_PASS1_BEGIN,
+  CALLBACK_EVENT_PASS1_FRAME,
+  CALLBACK_STATUS_PARAM,
+  CALLBACK_EVENT_PASS1_END,
+  CALLBACK_RESULT_PASS1_INTERIM,
+  CALLBACK_RESULT_PASS1,
+  CALLBACK_RESULT_PASS1_GRAPH,
+  CALLBACK_EVENT_PASS2_BEGIN,
+  CALLBACK_EVENT_PASS2_END,
+  CALLBACK_RESULT,
+  CALLBACK_RESULT_GMM,
+  CALLBACK_RESULT_GRAPH,
+  CALLBACK_RESULT_CONFNET,
+  CALLBACK_EVENT_PAUSE,
+  CALLBACK_EVENT_RESUME,
+  CALLBACK_PAUSE_FUNCTION,
+  SIZEOF_CALLBACK_ID
+};
+
+#define MAX_CALLBACK_HOOK 8
+
+typedef struct __Recog__ {
+  Jconf *jconf;
+  MFCCCalc *mfcclist;
+  RecogProcess *process_list;
+  GMMCalc *gc;
+  void (*callback_function[SIZEOF_CALLBACK_ID][MAX_CALLBACK_HOOK])(struct __Recog__ *recog, void *data);
+  void *callback_user_param[SIZEOF_CALLBACK_ID][MAX_CALLBACK_HOOK];
+  int callback_function_num[SIZEOF_CALLBACK_ID];
+} Recog;
+
+
+int callback_add(Recog *recog, int code, void (*func)(Recog *recog, void *data), void *data);
+boolean j_add_option(char *fmt, int argnum, int reqargnum, char *desc, boolean (*func)(Jconf *jconf, char *arg[], int argnum));
+void jlog(char *fmt, ...);
+char *center_name(char *hmmname, char *buf);
+void *mymalloc(size_t size);
+void *myrealloc(void *ptr, size_t size);
+void myfree(void *p);
+char *j_get_current_filename(Recog *recog);
+#ifdef CHARACTER_CONVERSION
+char *charconv(char *instr, char *outstr, int maxoutlen);
+#endif
+
+#define strmatch(A, B) (strcmp(A, B) == 0)
+
+#endif /* __BENCH_JULIUSLIB_H__ */
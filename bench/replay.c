@@ -0,0 +1,659 @@
+/**
+ * @file   replay.c
+ *
+ * <EN>
+ * @brief  Replay of callback traces through output_json.c
+ *
+ * Usage: replay [-n loops] [-m interval] [-M bytes] [-o file]
+ *               [-j "json options"] trace
+ *
+ * Rebuilds the Julius structures recorded by "-json trace=path" (see
+ * jsontrace.h) and fires the callbacks of the plugin with them, as
+ * Julius did when the trace was recorded, @a loops times over.  Only
+ * the callbacks are timed, not the decoding of the trace, and records
+ * per second, nanoseconds per output word, bytes per record and
+ * allocations per record are reported as by bench.  Records go to a
+ * temporary file unless -o is given, and -j passes options to "-json",
+ * so the output of two versions of the plugin can be compared on the
+ * same traffic.  With -m and -M, the replay is a soak test as with
+ * bench.  What the plugin prints on stdout is discarded.
+ * </EN>
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "fixture.h"
+#include "jsontrace.h"
+
+/* a dictionary of the trace, shared by the processes that use it */
+typedef struct {
+  WORD_INFO *winfo;
+  PROCESS_LM *lm;
+} ReplayDict;
+
+/* an engine of the trace and what has been defined for it */
+typedef struct {
+  Recog *recog;
+  RecogProcess **process;
+  int *sent_size;		///< sentences allocated for each process
+  int process_num;
+  ReplayDict *dict;
+  int dict_num;
+  HMM_Logical **hmm;
+  int hmm_num;
+  char *filename;		///< current input file
+  char *gmm;			///< name of the best GMM
+  char *best;			///< string of result_best_str()
+} ReplayEngine;
+
+static ReplayEngine *engine = NULL;
+static int engine_num = 0;
+
+/* time spent in the plugin, and what it was given */
+static double elapsed = 0;
+static long records = 0;
+static double words = 0;
+static FixtureSoak *soak = NULL;
+
+static double
+now_sec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(char *prog)
+{
+  fprintf(stderr, "usage: %s [-n loops] [-m interval] [-M bytes] [-o file] [-j \"json options\"] trace\n", prog);
+  exit(1);
+}
+
+static void
+corrupt()
+{
+  fprintf(stderr, "replay: trace is corrupt\n");
+  exit(1);
+}
+
+/* a string of the trace as a new NUL terminated one */
+static char *
+replay_string(JSONTraceReader *r)
+{
+  const char *s;
+  size_t len;
+  char *p;
+
+  s = jsontrace_string(r, &len);
+  if (s == NULL) corrupt();
+  p = (char *)malloc(len + 1);
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+/* replace *@a p by a string of the trace that may be absent */
+static void
+replay_string_opt(JSONTraceReader *r, char **p)
+{
+  free(*p);
+  *p = jsontrace_uint(r) ? replay_string(r) : NULL;
+}
+
+/* the engine of a record, which must have started up */
+static ReplayEngine *
+replay_engine(int id)
+{
+  if (id < 0 || id >= engine_num || engine[id].recog == NULL) corrupt();
+  return &(engine[id]);
+}
+
+/* an engine starts up, as the next one of the plugin */
+static void
+replay_startup(int id)
+{
+  Recog *recog;
+
+  if (id != engine_num) corrupt();
+  engine = (ReplayEngine *)realloc(engine, sizeof(ReplayEngine) * (engine_num + 1));
+  memset(&(engine[engine_num]), 0, sizeof(ReplayEngine));
+  recog = (Recog *)calloc(1, sizeof(Recog));
+  recog->jconf = (Jconf *)calloc(1, sizeof(Jconf));
+  recog->mfcclist = (MFCCCalc *)calloc(1, sizeof(MFCCCalc));
+  recog->mfcclist->param = (HTK_Param *)calloc(1, sizeof(HTK_Param));
+  recog->gc = (GMMCalc *)calloc(1, sizeof(GMMCalc));
+  recog->gc->max_d = (GMMData *)calloc(1, sizeof(GMMData));
+  recog->gc->max_d->name = "";
+  engine[engine_num++].recog = recog;
+  if (startup(recog) != 0) {
+    fprintf(stderr, "replay: failed to set up the plugin\n");
+    exit(1);
+  }
+}
+
+static void
+replay_dict(ReplayEngine *e, JSONTraceReader *r)
+{
+  WORD_INFO *winfo;
+  int d, num;
+
+  d = jsontrace_uint(r);
+  num = jsontrace_uint(r);
+  if (d > e->dict_num || num > WORD_INVALID) corrupt();
+  if (d == e->dict_num) {
+    e->dict = (ReplayDict *)realloc(e->dict, sizeof(ReplayDict) * (e->dict_num + 1));
+    e->dict[d].winfo = (WORD_INFO *)calloc(1, sizeof(WORD_INFO));
+    e->dict[d].lm = (PROCESS_LM *)calloc(1, sizeof(PROCESS_LM));
+    e->dict[d].lm->winfo = e->dict[d].winfo;
+    e->dict_num++;
+  }
+  winfo = e->dict[d].winfo;
+  if (num <= winfo->num) return;
+  winfo->wlen = (unsigned char *)realloc(winfo->wlen, num * sizeof(unsigned char));
+  winfo->wname = (char **)realloc(winfo->wname, num * sizeof(char *));
+  winfo->woutput = (char **)realloc(winfo->woutput, num * sizeof(char *));
+  winfo->wseq = (HMM_Logical ***)realloc(winfo->wseq, num * sizeof(HMM_Logical **));
+  memset(winfo->wlen + winfo->num, 0, (num - winfo->num) * sizeof(unsigned char));
+  memset(winfo->wname + winfo->num, 0, (num - winfo->num) * sizeof(char *));
+  memset(winfo->woutput + winfo->num, 0, (num - winfo->num) * sizeof(char *));
+  memset(winfo->wseq + winfo->num, 0, (num - winfo->num) * sizeof(HMM_Logical **));
+  winfo->num = winfo->maxnum = num;
+}
+
+static void
+replay_hmm(ReplayEngine *e, JSONTraceReader *r)
+{
+  HMM_Logical *h;
+
+  if ((int)jsontrace_uint(r) != e->hmm_num) corrupt();
+  h = (HMM_Logical *)calloc(1, sizeof(HMM_Logical));
+  h->name = replay_string(r);
+  h->body.defined = (HTK_HMM_Data *)calloc(1, sizeof(HTK_HMM_Data));
+  h->body.defined->name = h->name;
+  e->hmm = (HMM_Logical **)realloc(e->hmm, sizeof(HMM_Logical *) * (e->hmm_num + 1));
+  e->hmm[e->hmm_num++] = h;
+}
+
+static HMM_Logical *
+replay_hmm_ref(ReplayEngine *e, JSONTraceReader *r)
+{
+  unsigned int h = jsontrace_uint(r);
+
+  if (h >= (unsigned int)e->hmm_num) corrupt();
+  return e->hmm[h];
+}
+
+static void
+replay_word(ReplayEngine *e, JSONTraceReader *r)
+{
+  WORD_INFO *winfo;
+  unsigned int d, w;
+  int j;
+
+  d = jsontrace_uint(r);
+  w = jsontrace_uint(r);
+  if (d >= (unsigned int)e->dict_num || w >= e->dict[d].winfo->num) corrupt();
+  winfo = e->dict[d].winfo;
+  /* a word is defined again when it has changed */
+  free(winfo->wname[w]);
+  free(winfo->woutput[w]);
+  free(winfo->wseq[w]);
+  winfo->wname[w] = replay_string(r);
+  winfo->woutput[w] = replay_string(r);
+  winfo->wlen[w] = jsontrace_uint(r);
+  winfo->wseq[w] = (HMM_Logical **)calloc(winfo->wlen[w] + 1, sizeof(HMM_Logical *));
+  for(j=0;j<winfo->wlen[w];j++) winfo->wseq[w][j] = replay_hmm_ref(e, r);
+}
+
+static void
+replay_process(ReplayEngine *e, JSONTraceReader *r)
+{
+  RecogProcess *p;
+  unsigned int i, d;
+  char *name;
+
+  i = jsontrace_uint(r);
+  if (i > (unsigned int)e->process_num) corrupt();
+  if (i == (unsigned int)e->process_num) {
+    p = (RecogProcess *)calloc(1, sizeof(RecogProcess));
+    p->config = (JCONF_SEARCH *)calloc(1, sizeof(JCONF_SEARCH));
+    e->process = (RecogProcess **)realloc(e->process, sizeof(RecogProcess *) * (e->process_num + 1));
+    e->process[e->process_num] = p;
+    e->sent_size = (int *)realloc(e->sent_size, sizeof(int) * (e->process_num + 1));
+    e->sent_size[e->process_num] = 0;
+    /* processes appear in the order of the list */
+    if (e->process_num > 0) e->process[e->process_num - 1]->next = p;
+    else e->recog->process_list = p;
+    e->process_num++;
+  }
+  p = e->process[i];
+  p->config->id = jsontrace_int(r);
+  name = replay_string(r);
+  snprintf(p->config->name, sizeof(p->config->name), "%s", name);
+  free(name);
+  p->lmtype = jsontrace_uint(r);
+  p->config->mbr.use_mbr = jsontrace_uint(r);
+  d = jsontrace_uint(r);
+  if (d >= (unsigned int)e->dict_num) corrupt();
+  p->lm = e->dict[d].lm;
+}
+
+/* words of a sentence into @a seq of MAXSEQNUM words */
+static int
+replay_words(RecogProcess *p, JSONTraceReader *r, WORD_ID *seq)
+{
+  unsigned int i, num;
+
+  num = jsontrace_uint(r);
+  if (num > MAXSEQNUM) corrupt();
+  for(i=0;i<num;i++) {
+    seq[i] = jsontrace_uint(r);
+    if (seq[i] >= p->lm->winfo->num) corrupt();
+  }
+  return num;
+}
+
+static void
+replay_align_free(SentenceAlign *a)
+{
+  SentenceAlign *next;
+
+  for(;a;a=next) {
+    next = a->next;
+    free(a->ph);
+    free(a->loc);
+    free(a->begin_frame);
+    free(a->end_frame);
+    free(a->avgscore);
+    free(a);
+  }
+}
+
+static void
+replay_sentence(ReplayEngine *e, RecogProcess *p, JSONTraceReader *r, Sentence *s)
+{
+  SentenceAlign *a, **ap;
+  int i, n, num;
+
+  s->word_num = replay_words(p, r, s->word);
+  for(i=0;i<s->word_num;i++) s->confidence[i] = jsontrace_float(r);
+  s->score = jsontrace_float(r);
+  s->score_am = jsontrace_float(r);
+  s->score_lm = jsontrace_float(r);
+  s->gram_id = jsontrace_int(r);
+  s->score_mbr = jsontrace_float(r);
+  replay_align_free(s->align);
+  s->align = NULL;
+  ap = &(s->align);
+  n = jsontrace_uint(r);
+  while (n-- > 0 && ! r->error) {
+    a = (SentenceAlign *)calloc(1, sizeof(SentenceAlign));
+    a->unittype = jsontrace_uint(r);
+    a->num = num = jsontrace_uint(r);
+    if (num < 0 || num > r->end - r->p) corrupt();
+    a->ph = (HMM_Logical **)calloc(num + 1, sizeof(HMM_Logical *));
+    a->loc = (short *)calloc(num + 1, sizeof(short));
+    a->begin_frame = (int *)calloc(num + 1, sizeof(int));
+    a->end_frame = (int *)calloc(num + 1, sizeof(int));
+    a->avgscore = (LOGPROB *)calloc(num + 1, sizeof(LOGPROB));
+    for(i=0;i<num;i++) {
+      if (a->unittype != PER_WORD) {
+	a->ph[i] = replay_hmm_ref(e, r);
+	a->loc[i] = jsontrace_int(r);
+      }
+      a->begin_frame[i] = jsontrace_int(r);
+      a->end_frame[i] = jsontrace_int(r);
+      if (a->unittype != PER_WORD) a->avgscore[i] = jsontrace_float(r);
+    }
+    if (a->unittype != PER_WORD) a->allscore = jsontrace_float(r);
+    *ap = a;
+    ap = &(a->next);
+  }
+}
+
+static void
+replay_graph(RecogProcess *p, JSONTraceReader *r)
+{
+  WordGraph *wg;
+  int i, j, n, id;
+
+  for(wg=p->result.wg;wg;wg=wg->next) free(wg->rightword);
+  free(p->result.wg);
+  p->result.wg = NULL;
+  n = jsontrace_uint(r);
+  if (n <= 0) return;
+  if (n > r->end - r->p) corrupt();
+  wg = (WordGraph *)calloc(n, sizeof(WordGraph));
+  for(i=0;i<n;i++) {
+    wg[i].next = (i + 1 < n) ? &(wg[i + 1]) : NULL;
+    wg[i].wid = jsontrace_uint(r);
+    if (wg[i].wid >= p->lm->winfo->num) corrupt();
+    wg[i].id = jsontrace_int(r);
+    wg[i].lefttime = jsontrace_int(r);
+    wg[i].righttime = jsontrace_int(r);
+    wg[i].amavg = jsontrace_float(r);
+    wg[i].fscore_head = jsontrace_float(r);
+    wg[i].gscore_tail = jsontrace_float(r);
+    wg[i].graph_cm = jsontrace_float(r);
+    wg[i].rightwordnum = jsontrace_uint(r);
+    if (wg[i].rightwordnum < 0 || wg[i].rightwordnum > r->end - r->p) corrupt();
+    /* the ids of the right words for now, made pointers below */
+    wg[i].rightword = (WordGraph **)calloc(wg[i].rightwordnum + 1, sizeof(WordGraph *));
+    for(j=0;j<wg[i].rightwordnum;j++) wg[i].rightword[j] = (WordGraph *)(long)jsontrace_int(r);
+  }
+  for(i=0;i<n;i++) {
+    for(j=0;j<wg[i].rightwordnum;j++) {
+      id = (long)wg[i].rightword[j];
+      /* ids are the positions in the list after Julius sorts the graph */
+      if (id >= 0 && id < n && wg[id].id == id) {
+	wg[i].rightword[j] = &(wg[id]);
+      } else {
+	for(wg[i].rightword[j]=wg;wg[i].rightword[j]->id!=id;wg[i].rightword[j]++) {
+	  if (wg[i].rightword[j] == &(wg[n - 1])) corrupt();
+	}
+      }
+    }
+  }
+  p->result.wg = wg;
+}
+
+static void
+replay_confnet(RecogProcess *p, JSONTraceReader *r)
+{
+  CN_CLUSTER *c;
+  int i, j, n;
+
+  for(c=p->result.confnet;c;c=c->next) {
+    free(c->wseq);
+    free(c->pp);
+  }
+  free(p->result.confnet);
+  p->result.confnet = NULL;
+  n = jsontrace_uint(r);
+  if (n <= 0) return;
+  if (n > r->end - r->p) corrupt();
+  c = (CN_CLUSTER *)calloc(n, sizeof(CN_CLUSTER));
+  for(i=0;i<n;i++) {
+    c[i].next = (i + 1 < n) ? &(c[i + 1]) : NULL;
+    c[i].wseqnum = jsontrace_uint(r);
+    if (c[i].wseqnum < 0 || c[i].wseqnum > r->end - r->p) corrupt();
+    c[i].wseq = (WORD_ID *)calloc(c[i].wseqnum + 1, sizeof(WORD_ID));
+    c[i].pp = (LOGPROB *)calloc(c[i].wseqnum + 1, sizeof(LOGPROB));
+    for(j=0;j<c[i].wseqnum;j++) {
+      c[i].wseq[j] = jsontrace_uint(r);
+      if (c[i].wseq[j] != WORD_INVALID && c[i].wseq[j] >= p->lm->winfo->num) corrupt();
+    }
+    for(j=0;j<c[i].wseqnum;j++) c[i].pp[j] = jsontrace_float(r);
+  }
+  p->result.confnet = c;
+}
+
+/* the processes, with what callback @a code reads of them */
+static void
+replay_processes(ReplayEngine *e, JSONTraceReader *r, int code)
+{
+  RecogProcess *p;
+  unsigned int i, j, k, n, num;
+
+  n = jsontrace_uint(r);
+  for(k=0;k<n && ! r->error;k++) {
+    i = jsontrace_uint(r);
+    if (i >= (unsigned int)e->process_num) corrupt();
+    p = e->process[i];
+    p->live = jsontrace_uint(r);
+    p->have_interim = jsontrace_uint(r);
+    p->result.status = jsontrace_int(r);
+    p->result.num_frame = jsontrace_int(r);
+    switch(code) {
+    case CALLBACK_RESULT_PASS1_INTERIM:
+    case CALLBACK_RESULT_PASS1:
+      p->result.pass1.word_num = replay_words(p, r, p->result.pass1.word);
+      p->result.pass1.score = jsontrace_float(r);
+      break;
+    case CALLBACK_RESULT:
+      num = jsontrace_uint(r);
+      if (num > (unsigned int)(r->end - r->p)) corrupt();
+      if (num > (unsigned int)e->sent_size[i]) {
+	p->result.sent = (Sentence *)realloc(p->result.sent, sizeof(Sentence) * num);
+	memset(p->result.sent + e->sent_size[i], 0, sizeof(Sentence) * (num - e->sent_size[i]));
+	e->sent_size[i] = num;
+      }
+      p->result.sentnum = num;
+      for(j=0;j<num;j++) replay_sentence(e, p, r, &(p->result.sent[j]));
+      break;
+    case CALLBACK_RESULT_GRAPH:
+      replay_graph(p, r);
+      break;
+    case CALLBACK_RESULT_CONFNET:
+      replay_confnet(p, r);
+      break;
+    }
+  }
+}
+
+/* an event: rebuild what the callback reads, then fire it */
+static void
+replay_event(ReplayEngine *e, JSONTraceReader *r, boolean measure)
+{
+  Recog *recog = e->recog;
+  RecogProcess *p;
+  MFCCCalc *mfcc, **mp;
+  double start;
+  int code, n, i;
+
+  code = jsontrace_uint(r);
+  if (code < 0 || code >= SIZEOF_CALLBACK_ID) corrupt();
+  switch(code) {
+  case CALLBACK_STATUS_PARAM:
+    recog->jconf->input.period = jsontrace_int(r);
+    recog->jconf->input.frameshift = jsontrace_int(r);
+    n = jsontrace_uint(r);
+    if (n <= 0 || n > r->end - r->p) corrupt();
+    for(mp=&(recog->mfcclist);n-->0;mp=&((*mp)->next)) {
+      if (*mp == NULL) {
+	*mp = (MFCCCalc *)calloc(1, sizeof(MFCCCalc));
+	(*mp)->param = (HTK_Param *)calloc(1, sizeof(HTK_Param));
+      }
+      (*mp)->id = jsontrace_int(r);
+      (*mp)->param->samplenum = jsontrace_int(r);
+    }
+    for(mfcc=*mp;mfcc;mfcc=*mp) {
+      *mp = mfcc->next;
+      free(mfcc->param);
+      free(mfcc);
+    }
+    break;
+  case CALLBACK_RESULT_GMM:
+    if (jsontrace_uint(r)) {
+      free(e->gmm);
+      e->gmm = replay_string(r);
+      recog->gc->max_d->name = e->gmm;
+      recog->gc->gmm_max_cm = jsontrace_float(r);
+    }
+    break;
+  case CALLBACK_EVENT_RECOGNITION_END:
+    replay_string_opt(r, &(e->filename));
+    /* fall through */
+  case CALLBACK_RESULT_PASS1_INTERIM:
+  case CALLBACK_RESULT_PASS1:
+  case CALLBACK_RESULT:
+  case CALLBACK_RESULT_GRAPH:
+  case CALLBACK_RESULT_CONFNET:
+    replay_processes(e, r, code);
+    break;
+  }
+  if (r->error) corrupt();
+  fixture_filename = e->filename;
+  start = now_sec();
+  fixture_fire(recog, code);
+  if (soak != NULL && code == CALLBACK_EVENT_RECOGNITION_END) fixture_soak_utterance(soak);
+  if (! measure) return;
+  elapsed += now_sec() - start;
+  if (code == CALLBACK_EVENT_RECOGNITION_END) records++;
+  if (code == CALLBACK_RESULT) {
+    for(p=recog->process_list;p;p=p->next) {
+      if (! p->live) continue;
+      for(i=0;i<p->result.sentnum;i++) words += p->result.sent[i].word_num;
+    }
+  }
+}
+
+/* the best sentence, given without its engine as Julius does */
+static void
+replay_best(ReplayEngine *e, JSONTraceReader *r, boolean measure)
+{
+  double start;
+
+  replay_string_opt(r, &(e->best));
+  if (r->error) corrupt();
+  start = now_sec();
+  result_best_str(e->best);
+  if (measure) elapsed += now_sec() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  JSONTraceReader rd, payload;
+  FixtureSoak soak_state;
+  FILE *report;
+  Recog *scratch;
+  struct stat st;
+  char tmp[] = "/tmp/json-replay-XXXXXX";
+  char *outfile = NULL;
+  char *jsonopt = "";
+  char *args;
+  unsigned char *trace;
+  long loops = 1;
+  long interval = 0;
+  size_t tolerance = 65536;
+  long loop;
+  unsigned long allocs;
+  boolean measure;
+  off_t size;
+  ssize_t n;
+  size_t len;
+  int c, k, fd, tag, id;
+
+  while ((c = getopt(argc, argv, "n:m:M:o:j:")) != -1) {
+    switch(c) {
+    case 'n': loops = atol(optarg); break;
+    case 'm': interval = atol(optarg); break;
+    case 'M': tolerance = atol(optarg); break;
+    case 'o': outfile = optarg; break;
+    case 'j': jsonopt = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (loops <= 0 || interval < 0 || optind != argc - 1) usage(argv[0]);
+
+  /* the whole trace, so that reading it is not timed */
+  fd = open(argv[optind], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  trace = (unsigned char *)malloc(st.st_size + 1);
+  for(len=0;len<(size_t)st.st_size;len+=n) {
+    n = read(fd, trace + len, st.st_size - len);
+    if (n <= 0) break;
+  }
+  close(fd);
+  if (len < JSONTRACE_MAGIC_LEN || memcmp(trace, JSONTRACE_MAGIC, JSONTRACE_MAGIC_LEN) != 0) {
+    fprintf(stderr, "replay: %s is not a trace\n", argv[optind]);
+    return 1;
+  }
+
+  if (outfile != NULL) {
+    fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  } else {
+    fd = mkstemp(tmp);
+    if (fd >= 0) unlink(tmp);
+  }
+  if (fd < 0) {
+    perror("replay");
+    return 1;
+  }
+
+  /* keep stdout for the report only */
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    perror("replay");
+    return 1;
+  }
+
+  initialize();
+  args = (char *)malloc(strlen(jsonopt) + 32);
+  sprintf(args, "fd=%d noprefix %s", fd, jsonopt);
+  scratch = (Recog *)calloc(1, sizeof(Recog));
+  scratch->jconf = (Jconf *)calloc(1, sizeof(Jconf));
+  if (! fixture_option(scratch, args)) {
+    fprintf(stderr, "replay: failed to set up the plugin with \"%s\"\n", args);
+    return 1;
+  }
+  fixture_quiet = TRUE;
+  if (interval > 0) {
+    fixture_soak_init(&soak_state, interval, tolerance, report);
+    soak = &soak_state;
+  }
+
+  size = 0;
+  allocs = 0;
+  for(loop=0;loop<loops;loop++) {
+    /* the first of several loops warms up the caches of the plugin */
+    measure = (loops == 1 || loop > 0);
+    if (measure && (loops == 1 || loop == 1)) {
+      fstat(fd, &st);
+      size = st.st_size;
+      allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED);
+    }
+    rd.p = trace + JSONTRACE_MAGIC_LEN;
+    rd.end = trace + len;
+    rd.error = 0;
+    while ((tag = jsontrace_next(&rd, &id, &payload)) != 0) {
+      if (tag == JSONTRACE_EVENT) {
+	replay_event(replay_engine(id), &payload, measure);
+      } else if (tag == JSONTRACE_BEST) {
+	replay_best(replay_engine(id), &payload, measure);
+      } else if (loop > 0) {
+	/* what is defined stays for later loops */
+	continue;
+      } else if (tag == JSONTRACE_ENGINE) {
+	replay_startup(id);
+      } else if (tag == JSONTRACE_DICT) {
+	replay_dict(replay_engine(id), &payload);
+      } else if (tag == JSONTRACE_HMM) {
+	replay_hmm(replay_engine(id), &payload);
+      } else if (tag == JSONTRACE_WORD) {
+	replay_word(replay_engine(id), &payload);
+      } else if (tag == JSONTRACE_PROCESS) {
+	replay_process(replay_engine(id), &payload);
+      }
+      if (payload.error) corrupt();
+    }
+    /* a trace cut short at exit ends with a partial record */
+    if (rd.error && loop == 0) fprintf(stderr, "replay: trace ends with a partial record\n");
+  }
+  allocs = __atomic_load_n(&fixture_allocs, __ATOMIC_RELAXED) - allocs;
+  for(k=0;k<engine_num;k++) fixture_fire(engine[k].recog, CALLBACK_EVENT_STREAM_END);
+  fstat(fd, &st);
+  if (records == 0) {
+    fprintf(stderr, "replay: no utterance in the trace\n");
+    return 1;
+  }
+
+  if (engine_num > 1) fprintf(report, "engines       %d\n", engine_num);
+  fprintf(report, "records       %ld\n", records);
+  fprintf(report, "words/record  %.1f\n", words / records);
+  fprintf(report, "elapsed       %.3f s\n", elapsed);
+  fprintf(report, "records/sec   %.0f\n", records / elapsed);
+  fprintf(report, "ns/word       %.1f\n", (words > 0) ? elapsed * 1e9 / words : 0);
+  fprintf(report, "bytes/record  %.1f\n", (double)(st.st_size - size) / records);
+  fprintf(report, "allocs/record %.3f\n", (double)allocs / records);
+  if (soak != NULL) fprintf(report, "peak bytes    %lu\n", (unsigned long)fixture_peak_bytes);
+  if (soak != NULL && ! fixture_soak_check(soak)) return 1;
+  return 0;
+}
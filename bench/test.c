@@ -0,0 +1,351 @@
+/**
+ * @file   test.c
+ *
+ * <EN>
+ * @brief  Tests of output_json.c on synthetic results
+ *
+ * Usage: test
+ *
+ * Includes output_json.c to reach what it keeps static, sets up the
+ * plugin on a fixture as bench does, and runs the tests in turn.
+ * Each prints "name: ok" or "name: FAIL: why", and test exits with 1
+ * if any failed.
+ * </EN>
+ */
+
+#include "output_json.c"
+#include "fixture.h"
+
+/* records written so far, and how far they have been read */
+static int out_fd;
+static off_t out_read = 0;
+static FILE *report;
+static char trace_path[] = "/tmp/jsontrace.XXXXXX";
+
+static boolean
+fail(char *name, char *fmt, ...)
+{
+  va_list ap;
+
+  fprintf(report, "%s: FAIL: ", name);
+  va_start(ap, fmt);
+  vfprintf(report, fmt, ap);
+  va_end(ap);
+  fprintf(report, "\n");
+  return FALSE;
+}
+
+/* the records written since the last call, NUL terminated */
+static char *
+new_records()
+{
+  static char *buf = NULL;
+  static size_t size = 0;
+  size_t len = 0;
+  ssize_t n;
+
+  for(;;) {
+    if (size - len < 4096) {
+      size = (size == 0) ? 65536 : size * 2;
+      buf = (char *)realloc(buf, size);
+    }
+    n = pread(out_fd, buf + len, size - len - 1, out_read + len);
+    if (n <= 0) break;
+    len += n;
+  }
+  out_read += len;
+  buf[len] = '\0';
+  return buf;
+}
+
+/* WORD, CLASSID and PHONE of word @a w as in a WHYPO object */
+static char *
+word_members(WORD_INFO *winfo, WORD_ID w)
+{
+  static char str[4096];
+  char buf[MAX_HMMNAME_LEN];
+  char *p;
+  int j;
+
+  p = str + sprintf(str, "\"WORD\":\"%s\",\"CLASSID\":\"%s\",\"PHONE\":\"", winfo->woutput[w], winfo->wname[w]);
+  for(j=0;j<winfo->wlen[w];j++) {
+    p += sprintf(p, "%s%s", (j > 0) ? " " : "", center_name(winfo->wseq[w][j]->name, buf));
+  }
+  strcpy(p, "\"");
+  return str;
+}
+
+/**
+ * Rebuild the dictionary as Julius does when grammars change, with
+ * the new one at the addresses of the old one: every word named
+ * "<from>N" becomes "<to>N", which must be of the same length, and
+ * its phones are reversed, keeping all the pointers.
+ */
+static void
+dict_rewrite(WORD_INFO *winfo, char *from, char *to)
+{
+  HMM_Logical *h;
+  size_t len = strlen(from);
+  int i, j, n;
+
+  for(i=0;i<winfo->num;i++) {
+    if (strncmp(winfo->woutput[i], from, len) == 0) memcpy(winfo->woutput[i], to, len);
+    if (strncmp(winfo->wname[i], from, len) == 0) memcpy(winfo->wname[i], to, len);
+    n = winfo->wlen[i];
+    for(j=0;j<n/2;j++) {
+      h = winfo->wseq[i][j];
+      winfo->wseq[i][j] = winfo->wseq[i][n - 1 - j];
+      winfo->wseq[i][n - 1 - j] = h;
+    }
+  }
+}
+
+/* the next record after a rebuild in place must show the new words */
+static boolean
+test_dict_rebuild(Recog *recog, FixtureConf *conf)
+{
+  char *name = "dict_rebuild";
+  RecogProcess *r = recog->process_list;
+  WORD_INFO *winfo = r->lm->winfo;
+  WORD_ID w;
+
+  fixture_next(recog, conf);
+  fixture_utterance(recog, conf);
+  w = r->result.sent[0].word[1];
+  if (strstr(new_records(), word_members(winfo, w)) == NULL) {
+    return fail(name, "word %d is not %s", w, word_members(winfo, w));
+  }
+  dict_rewrite(winfo, "単語", "新語");
+  fixture_utterance(recog, conf);
+  if (strstr(new_records(), word_members(winfo, w)) == NULL) {
+    return fail(name, "word %d is not %s after the rebuild", w, word_members(winfo, w));
+  }
+  fprintf(report, "%s: ok\n", name);
+  return TRUE;
+}
+
+/**
+ * After a rebuild in place, the trace must define the words of the
+ * next utterance again, so that replay outputs the new words.
+ */
+static boolean
+test_trace_rebuild(Recog *recog, FixtureConf *conf)
+{
+  char *name = "trace_rebuild";
+  RecogProcess *r = recog->process_list;
+  WORD_INFO *winfo = r->lm->winfo;
+  Sentence *s = &(r->result.sent[0]);
+  JSONTraceReader rd, payload;
+  static char *def[WORD_INVALID];
+  unsigned char *buf;
+  const char *str;
+  size_t len;
+  struct stat st;
+  unsigned int w;
+  int fd, engine, i;
+
+  fixture_next(recog, conf);
+  fixture_utterance(recog, conf);
+  dict_rewrite(winfo, "新語", "別語");
+  fixture_utterance(recog, conf);
+  new_records();
+
+  /* the last definition of each word */
+  fd = open(trace_path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) return fail(name, "cannot read the trace");
+  buf = (unsigned char *)malloc(st.st_size);
+  if (read(fd, buf, st.st_size) != st.st_size) return fail(name, "cannot read the trace");
+  close(fd);
+  rd.p = buf + JSONTRACE_MAGIC_LEN;
+  rd.end = buf + st.st_size;
+  rd.error = 0;
+  while ((i = jsontrace_next(&rd, &engine, &payload)) != 0) {
+    if (i != JSONTRACE_WORD || jsontrace_uint(&payload) != 0) continue;
+    w = jsontrace_uint(&payload);
+    str = jsontrace_string(&payload, &len);
+    str = jsontrace_string(&payload, &len);
+    if (w >= WORD_INVALID || str == NULL) return fail(name, "broken word definition");
+    free(def[w]);
+    def[w] = strndup(str, len);
+  }
+  free(buf);
+  if (rd.error) return fail(name, "broken trace");
+
+  for(i=0;i<s->word_num;i++) {
+    w = s->word[i];
+    if (def[w] == NULL || strcmp(def[w], winfo->woutput[w]) != 0) {
+      return fail(name, "word %d is defined as \"%s\", not \"%s\"", w, def[w] ? def[w] : "", winfo->woutput[w]);
+    }
+  }
+  fprintf(report, "%s: ok\n", name);
+  return TRUE;
+}
+
+/* each status slot of the metrics must have a label of its own */
+static boolean
+test_metric_labels()
+{
+  char *name = "metric_labels";
+  int i, j;
+
+  for(i=0;i<METRIC_STATUS;i++) {
+    for(j=0;j<i;j++) {
+      if (strcmp(metric_status_label(i), metric_status_label(j)) == 0) {
+	return fail(name, "slots %d and %d are both \"%s\"", j, i, metric_status_label(i));
+      }
+    }
+  }
+  fprintf(report, "%s: ok\n", name);
+  return TRUE;
+}
+
+/**
+ * Once a second engine has started, the records of both must tell
+ * their engine.  Runs last, as the other tests expect a single engine.
+ */
+static boolean
+test_engine_tag(Recog *recog, FixtureConf *conf)
+{
+  char *name = "engine_tag";
+  FixtureConf conf2 = *conf;
+  Recog *recog2;
+  char *rec;
+
+  fixture_next(recog, conf);
+  fixture_utterance(recog, conf);
+  rec = new_records();
+  if (strncmp(rec, "{\"ENGINE\"", 9) == 0) return fail(name, "a single engine tags its records");
+  recog2 = fixture_recog(&conf2);
+  if (startup(recog2) != 0) return fail(name, "cannot start a second engine");
+  fixture_utterance(recog, conf);
+  rec = new_records();
+  if (strncmp(rec, "{\"ENGINE\":0,", 12) != 0) return fail(name, "record of engine 0 begins %.20s", rec);
+  fixture_next(recog2, &conf2);
+  fixture_utterance(recog2, &conf2);
+  rec = new_records();
+  if (strncmp(rec, "{\"ENGINE\":1,", 12) != 0) return fail(name, "record of engine 1 begins %.20s", rec);
+  fprintf(report, "%s: ok\n", name);
+  return TRUE;
+}
+
+/* float @a f in its shortest form must read back bit for bit */
+static boolean
+float_check(char *name, float f)
+{
+  char str[32], buf[32];
+  uint32_t bits, back, d;
+  float g;
+  int len, digits, prec, exp10;
+
+  memcpy(&bits, &f, 4);
+  len = f2s_format(str, f);
+  str[len] = '\0';
+  g = strtof(str, NULL);
+  memcpy(&back, &g, 4);
+  if (back != bits) return fail(name, "%08x is written %s, read back as %08x", bits, str, back);
+  /* and be no longer than the fewest printf() digits that do */
+  for(prec=1;prec<9;prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, f);
+    if (strtof(buf, NULL) == f) break;
+  }
+  if ((bits << 1) == 0) return TRUE;
+  for(d=f2s_digits(bits & 0x7fffff, (bits >> 23) & 0xff, &exp10),digits=0;d>0;d/=10) digits++;
+  if (digits > prec) return fail(name, "%08x is written %s, where %.*e reads back", bits, str, prec - 1, f);
+  return TRUE;
+}
+
+/**
+ * Shortest floats read back: 0 and -0, every power of two, the edges
+ * of the subnormals, integers and short decimals, whose trailing
+ * zeros take the exact paths, and a sample of all bit patterns.
+ */
+static boolean
+test_float_roundtrip()
+{
+  char *name = "float_roundtrip";
+  static const struct { float f; char *str; } fixed[] = {
+    { 0.0f, "0" }, { -0.0f, "-0" }, { 1.0f, "1" }, { 0.1f, "0.1" },
+    { -2.5f, "-2.5" }, { 100.0f, "100" }, { 1e-7f, "1e-7" },
+    { 1.4e-45f, "1e-45" }, { 3.4028235e38f, "3.4028235e38" },
+    { 1.17549435e-38f, "1.1754944e-38" }, { 16777216.0f, "16777216" },
+  };
+  char str[32];
+  uint32_t bits, seed = 1;
+  float f;
+  int i, e;
+
+  for(i=0;i<(int)(sizeof(fixed)/sizeof(fixed[0]));i++) {
+    str[f2s_format(str, fixed[i].f)] = '\0';
+    if (strcmp(str, fixed[i].str) != 0) return fail(name, "%s is written %s", fixed[i].str, str);
+  }
+  for(e=0;e<255;e++) {
+    bits = (uint32_t)e << 23;
+    memcpy(&f, &bits, 4);
+    if (! float_check(name, f) || ! float_check(name, -f)) return FALSE;
+  }
+  for(i=0;i<=0x7fffff;i+=(i < 0x1000 || i > 0x7ff000) ? 1 : 0x1001) {
+    bits = i;
+    memcpy(&f, &bits, 4);
+    if (! float_check(name, f)) return FALSE;
+  }
+  for(i=1;i<=20000;i++) {
+    if (! float_check(name, (float)i) || ! float_check(name, i / 1000.0f) || ! float_check(name, i * 1e7f)) return FALSE;
+  }
+  for(i=0;i<200000;i++) {
+    seed = seed * 1664525 + 1013904223;
+    bits = seed;
+    if (((bits >> 23) & 0xff) == 0xff) continue;
+    memcpy(&f, &bits, 4);
+    if (! float_check(name, f)) return FALSE;
+  }
+  fprintf(report, "%s: ok\n", name);
+  return TRUE;
+}
+
+int
+main()
+{
+  FixtureConf conf = { 500, 2, 6, 5, 1, FALSE, 0, 0, 0, 0, 0, 1 };
+  Recog *recog;
+  char out[] = "/tmp/jsontest.XXXXXX";
+  char args[256];
+  boolean ok = TRUE;
+  int fd;
+
+  out_fd = mkstemp(out);
+  if (out_fd < 0) {
+    perror("test");
+    return 1;
+  }
+  unlink(out);
+  fd = mkstemp(trace_path);
+  if (fd < 0) {
+    perror("test");
+    return 1;
+  }
+  close(fd);
+  /* keep stdout for the report only */
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    perror("test");
+    return 1;
+  }
+
+  recog = fixture_recog(&conf);
+  initialize();
+  sprintf(args, "fd=%d noprefix trace=%s", out_fd, trace_path);
+  if (! fixture_option(recog, args) || startup(recog) != 0) {
+    fprintf(stderr, "test: failed to set up the plugin with \"%s\"\n", args);
+    return 1;
+  }
+  fixture_quiet = TRUE;
+
+  ok &= test_dict_rebuild(recog, &conf);
+  ok &= test_trace_rebuild(recog, &conf);
+  ok &= test_metric_labels();
+  ok &= test_float_roundtrip();
+  ok &= test_engine_tag(recog, &conf);
+  unlink(trace_path);
+  fclose(report);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file   jsonring.c
+ *
+ * <EN>
+ * @brief  Print records from the shared memory ring of output_json
+ *
+ * Usage: jsonring [-a] file
+ *
+ * Maps the ring file created by "-json shm=file" and prints each new
+ * record as a line.  With -a, records still left in the ring are
+ * printed first.  When the reader is overrun, the number of records
+ * missed is reported on stderr.  When output_json creates the ring
+ * again, the new one is followed.
+ * </EN>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "jsonring.h"
+
+static void *map = NULL;
+static size_t mapsize = 0;
+static ino_t mapino = 0;
+
+/* map the ring file; returns 0 on success */
+static int
+ring_map(char *path, JSONRingReader *r)
+{
+  struct stat st;
+  int fd;
+
+  if (map != NULL) munmap(map, mapsize);
+  map = NULL;
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0 || st.st_size < JSONRING_HEADER_SIZE) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    return -1;
+  }
+  mapsize = st.st_size;
+  mapino = st.st_ino;
+  if (jsonring_attach(r, map) < 0
+      || mapsize < r->hdr->header_size + r->hdr->size) {
+    munmap(map, mapsize);
+    map = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/* has the ring file been created again? */
+static int
+ring_replaced(char *path)
+{
+  struct stat st;
+
+  return (stat(path, &st) == 0 && st.st_ino != mapino);
+}
+
+int
+main(int argc, char *argv[])
+{
+  JSONRingReader r;
+  const char *rec;
+  char *buf = NULL;
+  size_t bufsize = 0;
+  unsigned long lost = 0;
+  uint32_t len;
+  int all = 0;
+  int idle = 0;
+  char *path;
+
+  if (argc == 3 && strcmp(argv[1], "-a") == 0) {
+    all = 1;
+    path = argv[2];
+  } else if (argc == 2) {
+    path = argv[1];
+  } else {
+    fprintf(stderr, "usage: %s [-a] file\n", argv[0]);
+    return 1;
+  }
+
+  while (ring_map(path, &r) < 0) {
+    if (errno != ENOENT && errno != 0) {
+      fprintf(stderr, "%s: %s: %s\n", argv[0], path, strerror(errno));
+      return 1;
+    }
+    usleep(100000);
+  }
+  if (all) jsonring_rewind(&r);
+
+  for(;;) {
+    if (jsonring_next(&r, &rec, &len) == 0) {
+      fflush(stdout);
+      if (++idle >= 1000) {
+	/* check once a second if the writer has restarted */
+	idle = 0;
+	if (ring_replaced(path) && ring_map(path, &r) == 0) jsonring_rewind(&r);
+      }
+      usleep(1000);
+      continue;
+    }
+    idle = 0;
+    /* copy out, as the writer may overwrite it while we print */
+    if (len > bufsize) {
+      bufsize = len;
+      buf = realloc(buf, bufsize);
+      if (buf == NULL) {
+	fprintf(stderr, "%s: out of memory\n", argv[0]);
+	return 1;
+      }
+    }
+    memcpy(buf, rec, len);
+    if (jsonring_check(&r)) fwrite(buf, 1, len, stdout);
+    if (r.lost != lost) {
+      fprintf(stderr, "%s: overrun, %lu records missed\n", argv[0], (unsigned long)(r.lost - lost));
+      lost = r.lost;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file   jsonring.h
+ *
+ * <EN>
+ * @brief  Layout of the shared memory ring of JSON records, and a reader
+ *
+ * output_json writes records into a file mapped into memory ("-json
+ * shm=path"), and readers on the same host map the same file and
+ * consume records in place without any system call.
+ *
+ * The file starts with a JSONRingHeader of JSONRING_HEADER_SIZE bytes,
+ * followed by the data area of @a size bytes.  Positions are byte
+ * counts since the ring was created and never wrap; the offset in the
+ * data area is the position modulo @a size.  Each record is stored as
+ * a JSONRingFrame followed by the record, padded to 16 bytes.  A frame
+ * never wraps around: when it does not fit at the end of the data
+ * area, a padding frame fills the rest and the record starts over at
+ * offset 0.
+ *
+ * The writer publishes @a head after a record is complete.  Before it
+ * overwrites old frames it raises @a tail past them, so a reader knows
+ * that everything before @a tail may be overwritten.  A reader takes
+ * a record at @a pos, uses it, and then checks that @a tail has not
+ * passed @a pos meanwhile.  If it has, the record may be torn and the
+ * reader was overrun; it starts again at @a tail, and the gap in the
+ * frame sequence numbers tells how many records it missed.
+ * </EN>
+ */
+
+#ifndef __JSONRING_H__
+#define __JSONRING_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define JSONRING_MAGIC 0x474e4952534a4e4fULL ///< "ONJSRING"
+#define JSONRING_VERSION 1
+#define JSONRING_HEADER_SIZE 4096 ///< offset of the data area
+#define JSONRING_PAD 0xffffffffU ///< frame length of padding frames
+
+#define JSONRING_ALIGN(x) (((x) + 15) & ~(uint64_t)15)
+#define JSONRING_SEQ_ANY UINT64_MAX ///< no sequence number expected
+
+typedef struct {
+  uint64_t magic;		///< JSONRING_MAGIC
+  uint32_t version;		///< JSONRING_VERSION
+  uint32_t header_size;		///< JSONRING_HEADER_SIZE
+  uint64_t size;		///< bytes of the data area, a power of two
+  uint64_t head;		///< position after the last complete record
+  uint64_t tail;		///< frames before this may be overwritten
+  uint64_t seq;			///< number of records written
+} JSONRingHeader;
+
+typedef struct {
+  uint32_t len;			///< bytes of the record, or JSONRING_PAD
+  uint32_t reserved;
+  uint64_t seq;			///< sequence number of the record
+} JSONRingFrame;
+
+#define JSONRING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define JSONRING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * Reader state.  Set @a hdr and @a data to the mapped file with
+ * jsonring_attach() before use.
+ */
+typedef struct {
+  const JSONRingHeader *hdr;
+  const char *data;
+  uint64_t pos;			///< position of the next frame to read
+  uint64_t seq;			///< expected sequence number of it
+  uint64_t last;		///< position of the frame last returned
+  uint64_t lost;		///< records missed by overrun
+} JSONRingReader;
+
+/**
+ * Attach a reader to a mapped ring.  Reading starts from the next
+ * record written.  Returns 0, or -1 if the map is not a ring.
+ */
+static inline int
+jsonring_attach(JSONRingReader *r, const void *map)
+{
+  const JSONRingHeader *hdr = (const JSONRingHeader *)map;
+
+  if (hdr->magic != JSONRING_MAGIC || hdr->version != JSONRING_VERSION) return -1;
+  r->hdr = hdr;
+  r->data = (const char *)map + hdr->header_size;
+  r->pos = r->last = JSONRING_LOAD(&(hdr->head));
+  r->seq = JSONRING_LOAD(&(hdr->seq));
+  r->lost = 0;
+  return 0;
+}
+
+/* restart at the oldest frame still in the ring */
+static inline void
+jsonring_resync(JSONRingReader *r)
+{
+  r->pos = JSONRING_LOAD(&(r->hdr->tail));
+}
+
+/**
+ * Let the reader start from the oldest record left in the ring instead
+ * of the next one written.
+ */
+static inline void
+jsonring_rewind(JSONRingReader *r)
+{
+  jsonring_resync(r);
+  r->seq = JSONRING_SEQ_ANY;
+}
+
+/**
+ * Get the next record.  On return of 1, @a buf points to the record of
+ * @a len bytes in the ring; it is only known to be intact if
+ * jsonring_check() returns 1 after it has been used.  Returns 0 when
+ * no new record is there.
+ */
+static inline int
+jsonring_next(JSONRingReader *r, const char **buf, uint32_t *len)
+{
+  const JSONRingFrame *f;
+  uint64_t head, size, seq;
+  uint32_t l;
+
+  size = r->hdr->size;
+  for(;;) {
+    head = JSONRING_LOAD(&(r->hdr->head));
+    if (r->pos >= head) {
+      if (r->pos > head) r->pos = head; /* writer has restarted */
+      return 0;
+    }
+    if (JSONRING_LOAD(&(r->hdr->tail)) > r->pos) jsonring_resync(r);
+    f = (const JSONRingFrame *)(r->data + (r->pos & (size - 1)));
+    l = f->len;
+    seq = f->seq;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (JSONRING_LOAD(&(r->hdr->tail)) > r->pos) continue;
+    if (l == JSONRING_PAD) {
+      r->pos += size - (r->pos & (size - 1));
+      continue;
+    }
+    if (seq != r->seq) {
+      if (seq > r->seq && r->seq != JSONRING_SEQ_ANY) r->lost += seq - r->seq;
+      r->seq = seq;
+    }
+    *buf = (const char *)(f + 1);
+    *len = l;
+    r->last = r->pos;
+    r->pos += JSONRING_ALIGN(sizeof(JSONRingFrame) + l);
+    r->seq++;
+    return 1;
+  }
+}
+
+/**
+ * Check that the record last returned by jsonring_next() was not
+ * overwritten while it was used.  Returns 1 if it is intact, or 0 if
+ * the reader was overrun; in that case the record must be discarded
+ * and the reader goes on from the oldest record left in the ring.
+ */
+static inline int
+jsonring_check(JSONRingReader *r)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (JSONRING_LOAD(&(r->hdr->tail)) <= r->last) return 1;
+  r->lost++;
+  jsonring_resync(r);
+  return 0;
+}
+
+#endif /* __JSONRING_H__ */
@@ -0,0 +1,222 @@
+/**
+ * @file   jsontrace.h
+ *
+ * <EN>
+ * @brief  Format of the callback traces of output_json, and a decoder
+ *
+ * With "-json trace=path", output_json records what each of its
+ * callbacks is given by Julius: the status of the processes, their
+ * sentences, word graphs and confusion networks, the input length,
+ * the best sentence string, and the dictionary words and HMMs they
+ * refer to.  bench/replay rebuilds the Julius structures from a trace
+ * and fires the same callbacks, so the output of real traffic can be
+ * reproduced and timed without models or audio.
+ *
+ * The file starts with the 8 bytes of JSONTRACE_MAGIC, followed by
+ * records.  A record is a tag byte, then the engine and the length of
+ * the payload as unsigned varints, then the payload; a reader skips
+ * the tags it does not know.  Integers are LEB128 varints, signed ones
+ * zigzag encoded, floats are the 4 bytes of their IEEE 754 single
+ * precision bits in little endian order, and strings are a length
+ * followed by the bytes, without NUL.  A string that may be absent is
+ * preceded by 1 if present or 0 if not.
+ *
+ * Dictionaries, words and HMMs are given IDs in order of appearance,
+ * and are defined by their own records before the first event that
+ * refers to them.  A word that has changed since, as when Julius has
+ * rebuilt the dictionary for a new grammar, is defined again before
+ * the next event that refers to it.  The records of an engine are in
+ * the order they were made, but the records of different engines are
+ * interleaved by whole utterances.
+ * </EN>
+ */
+
+#ifndef __JSONTRACE_H__
+#define __JSONTRACE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define JSONTRACE_MAGIC "JSTRACE1"
+#define JSONTRACE_MAGIC_LEN 8
+
+/* record tags */
+enum {
+  JSONTRACE_ENGINE = 1,	///< an engine has started up; no payload
+  JSONTRACE_DICT,	///< dict, words in it
+  JSONTRACE_HMM,	///< hmm, name
+  JSONTRACE_WORD,	///< dict, word, wname, woutput, wlen, hmm of each phone
+  JSONTRACE_PROCESS,	///< index, id (signed), name, lmtype, use_mbr, dict
+  JSONTRACE_EVENT,	///< callback ID, and what the callback reads, see below
+  JSONTRACE_BEST,	///< the string given to result_best_str(), may be absent
+  JSONTRACE_TAG_NUM
+};
+
+/*
+ * Payload of JSONTRACE_EVENT after the callback ID:
+ *
+ * CALLBACK_STATUS_PARAM: period, frameshift, the number of MFCC
+ *   instances, and id and samplenum of each.
+ * CALLBACK_RESULT_GMM: 1, the name of the best GMM and its CM, or 0.
+ * CALLBACK_EVENT_RECOGNITION_END: the current input file, may be
+ *   absent, then the processes.
+ * CALLBACK_RESULT_PASS1_INTERIM, CALLBACK_RESULT_PASS1,
+ * CALLBACK_RESULT, CALLBACK_RESULT_GRAPH, CALLBACK_RESULT_CONFNET:
+ *   the processes.
+ * Others: nothing.
+ *
+ * The processes are their number, and for each the index of a
+ * JSONTRACE_PROCESS, live, have_interim, status (signed) and
+ * num_frame, followed by what the callback reads:
+ *
+ * PASS1_INTERIM, PASS1: the 1st pass sentence, as word_num, the words
+ *   and the score.
+ * RESULT: sentnum, and for each sentence word_num, the words, their
+ *   confidences, score, score_am, score_lm, gram_id, score_mbr, and
+ *   the number of alignments with for each unittype and num; then for
+ *   a word alignment the begin and end frame of each word, and for a
+ *   phoneme or state alignment the hmm, loc, begin frame, end frame and
+ *   average score of each unit, and allscore.
+ * GRAPH: the number of nodes, 0 for none, and for each node wid, id,
+ *   lefttime, righttime, amavg, fscore_head, gscore_tail, graph_cm,
+ *   and the id of each of its right words after their number.
+ * CONFNET: the number of slots, 0 for none, and for each slot the
+ *   number of words, the words (WORD_INVALID to skip the slot) and
+ *   their posteriors.
+ */
+
+/* longest encoding of a varint */
+#define JSONTRACE_VARINT_MAX 10
+
+static inline size_t
+jsontrace_put_uint(unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return n;
+}
+
+static inline size_t
+jsontrace_put_int(unsigned char *p, int64_t v)
+{
+  return jsontrace_put_uint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static inline size_t
+jsontrace_put_float(unsigned char *p, float f)
+{
+  uint32_t u;
+
+  memcpy(&u, &f, 4);
+  p[0] = u;
+  p[1] = u >> 8;
+  p[2] = u >> 16;
+  p[3] = u >> 24;
+  return 4;
+}
+
+/**
+ * Decoder of a payload.  @a error is set when it runs past the end,
+ * after which every value read is 0.
+ */
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+  int error;
+} JSONTraceReader;
+
+static inline uint64_t
+jsontrace_uint(JSONTraceReader *r)
+{
+  uint64_t v = 0;
+  int shift = 0;
+
+  while (r->p < r->end && shift < 64) {
+    v |= (uint64_t)(*r->p & 0x7f) << shift;
+    if ((*r->p++ & 0x80) == 0) return v;
+    shift += 7;
+  }
+  r->error = 1;
+  r->p = r->end;
+  return 0;
+}
+
+static inline int64_t
+jsontrace_int(JSONTraceReader *r)
+{
+  uint64_t u = jsontrace_uint(r);
+
+  return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static inline float
+jsontrace_float(JSONTraceReader *r)
+{
+  uint32_t u;
+  float f;
+
+  if (r->end - r->p < 4) {
+    r->error = 1;
+    r->p = r->end;
+    return 0;
+  }
+  u = r->p[0] | (r->p[1] << 8) | (r->p[2] << 16) | ((uint32_t)r->p[3] << 24);
+  r->p += 4;
+  memcpy(&f, &u, 4);
+  return f;
+}
+
+/**
+ * Get a string: @a len bytes at the returned pointer, which is not NUL
+ * terminated, or NULL on error.
+ */
+static inline const char *
+jsontrace_string(JSONTraceReader *r, size_t *len)
+{
+  const char *s;
+  uint64_t n = jsontrace_uint(r);
+
+  if (n > (uint64_t)(r->end - r->p)) {
+    r->error = 1;
+    r->p = r->end;
+    *len = 0;
+    return NULL;
+  }
+  s = (const char *)r->p;
+  r->p += n;
+  *len = n;
+  return s;
+}
+
+/**
+ * Get the next record of a trace from @a r over the records, and set
+ * @a payload to read it.  Returns the tag, or 0 at the end or on a
+ * truncated record.
+ */
+static inline int
+jsontrace_next(JSONTraceReader *r, int *engine, JSONTraceReader *payload)
+{
+  uint64_t len;
+  int tag;
+
+  if (r->p >= r->end) return 0;
+  tag = *r->p++;
+  *engine = jsontrace_uint(r);
+  len = jsontrace_uint(r);
+  if (r->error || len > (uint64_t)(r->end - r->p)) {
+    r->error = 1;
+    return 0;
+  }
+  payload->p = r->p;
+  payload->end = r->p + len;
+  payload->error = 0;
+  r->p += len;
+  return tag;
+}
+
+#endif /* __JSONTRACE_H__ */
@@ -7,221 +7,4483 @@
 
 #include <julius/juliuslib.h>
 #include <stdio.h>
-#include "parson.h"
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdarg.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_JSON_SERVER
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_JSON_SIMD
+#endif
+#ifdef CHARACTER_CONVERSION
+#include <iconv.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "jsonring.h"
+#include "jsontrace.h"
 
 /*extern boolean separate_score_flag;*/
 /*static int outout_json_flag = 0;*/
 static int outout_json_flag = 1;
-static JSON_Value *root_value = NULL;
-static JSON_Object *root_object = NULL;
 
+/**
+ * Fields of a record that can be selected with "fields=".  A field
+ * that is not selected is not even computed.
+ */
+enum {
+  FIELD_TIME, FIELD_PASS1, FIELD_INPUT, FIELD_RECOGOUT, FIELD_GMM,
+  FIELD_SENTENCE, FIELD_SUCCEEDED, FIELD_RESULT,
+  FIELD_SHYPO_RANK, FIELD_SHYPO_SCORE, FIELD_SHYPO_AMSCORE,
+  FIELD_SHYPO_LMSCORE, FIELD_SHYPO_GRAM, FIELD_SHYPO_MBRSCORE,
+  FIELD_SHYPO_ALIGN,
+  FIELD_WHYPO_WORD, FIELD_WHYPO_CLASSID, FIELD_WHYPO_PHONE,
+  FIELD_WHYPO_CM, FIELD_WHYPO_FRAME, FIELD_GRAPH, FIELD_CONFNET,
+  FIELD_LATENCY, FIELD_ENGINE, FIELD_SOURCE
+};
+#define FIELD(F) (1UL << (F))
+#define FIELDS_FULL (FIELD(FIELD_LATENCY) - 1) ///< all but LATENCY, ENGINE and SOURCE, which are only output on request
+#define FIELD_ON(F) (json_conf.fields & FIELD(F))
+
+#define FIELDS_WHYPO (FIELD(FIELD_WHYPO_WORD) | FIELD(FIELD_WHYPO_CLASSID) | FIELD(FIELD_WHYPO_PHONE) | FIELD(FIELD_WHYPO_CM) | FIELD(FIELD_WHYPO_FRAME))
+#define FIELDS_SHYPO (FIELD(FIELD_SHYPO_RANK) | FIELD(FIELD_SHYPO_SCORE) | FIELD(FIELD_SHYPO_AMSCORE) | FIELD(FIELD_SHYPO_LMSCORE) | FIELD(FIELD_SHYPO_GRAM) | FIELD(FIELD_SHYPO_MBRSCORE) | FIELD(FIELD_SHYPO_ALIGN) | FIELDS_WHYPO)
+
+/* names for "fields=", each with the fields it selects */
+static const struct {
+  const char *name;
+  unsigned long fields;
+} field_name[] = {
+  /* profiles */
+  { "full", FIELDS_FULL },
+  { "standard", FIELD(FIELD_TIME) | FIELD(FIELD_INPUT) | FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_RANK) | FIELD(FIELD_SHYPO_SCORE) | FIELD(FIELD_WHYPO_WORD) | FIELD(FIELD_WHYPO_CM) | FIELD(FIELD_WHYPO_FRAME) | FIELD(FIELD_SENTENCE) | FIELD(FIELD_SUCCEEDED) },
+  { "minimal", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_WORD) | FIELD(FIELD_WHYPO_CM) | FIELD(FIELD_SENTENCE) | FIELD(FIELD_SUCCEEDED) },
+  /* members and their parts */
+  { "TIME", FIELD(FIELD_TIME) },
+  { "PASS1", FIELD(FIELD_PASS1) },
+  { "INPUT", FIELD(FIELD_INPUT) },
+  { "RECOGOUT", FIELD(FIELD_RECOGOUT) | FIELDS_SHYPO },
+  { "GMM", FIELD(FIELD_GMM) },
+  { "sentence", FIELD(FIELD_SENTENCE) },
+  { "succeeded", FIELD(FIELD_SUCCEEDED) },
+  { "result", FIELD(FIELD_RESULT) },
+  { "GRAPH", FIELD(FIELD_GRAPH) },
+  { "CONFNET", FIELD(FIELD_CONFNET) },
+  { "SHYPO", FIELD(FIELD_RECOGOUT) | FIELDS_SHYPO },
+  { "SHYPO.RANK", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_RANK) },
+  { "SHYPO.SCORE", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_SCORE) },
+  { "SHYPO.AMSCORE", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_AMSCORE) },
+  { "SHYPO.LMSCORE", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_LMSCORE) },
+  { "SHYPO.GRAM", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_GRAM) },
+  { "SHYPO.MBRSCORE", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_MBRSCORE) },
+  { "SHYPO.ALIGN", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_SHYPO_ALIGN) },
+  { "WHYPO", FIELD(FIELD_RECOGOUT) | FIELDS_WHYPO },
+  { "WHYPO.WORD", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_WORD) },
+  { "WHYPO.CLASSID", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_CLASSID) },
+  { "WHYPO.PHONE", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_PHONE) },
+  { "WHYPO.CM", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_CM) },
+  { "WHYPO.FRAME", FIELD(FIELD_RECOGOUT) | FIELD(FIELD_WHYPO_FRAME) },
+  { "LATENCY", FIELD(FIELD_LATENCY) },
+  { "ENGINE", FIELD(FIELD_ENGINE) },
+  { "SOURCE", FIELD(FIELD_SOURCE) },
+  { NULL, 0 }
+};
+
+/**
+ * Output settings given by the arguments of "-json".
+ */
+static struct {
+  int fd;			///< descriptor records are written to
+  char *filename;		///< file to append records to, or NULL
+  int prefix;			///< "JSON> " before each record (-1: default)
+  int async;			///< slots of the writer thread queue, 0 to write inline
+  int overflow;			///< what to do when the queue is full
+  boolean interim;		///< output 1st pass interim results
+  int interim_msec;		///< minimum interval of interim records
+  int interim_frames;		///< minimum frames between interim records
+  char *unixpath;		///< serve records on this Unix domain socket
+  int tcpport;			///< serve records on this loopback TCP port
+  int clientqueue;		///< bytes queued for each client at most
+  char *shmpath;		///< write records into a ring mapped from this file
+  size_t shmsize;		///< bytes of the ring data area
+  int format;			///< encoding of records
+  unsigned long fields;		///< fields to output, bits of FIELD()
+  char *metrics;		///< file or "unix:path" to expose metrics at
+  int metrics_interval;		///< seconds between metrics updates, 0 for none
+  int floats;			///< how floats are written in JSON
+  int cmdigits;			///< decimal places of confidence scores, or -1
+  int scoredigits;		///< decimal places of scores, or -1
+  boolean slash;		///< escape "/" as "\/" in strings
+  char *charset;		///< code of dictionary strings, or NULL for UTF-8
+  char *batch;			///< write records into shards with this prefix
+  unsigned long batch_records;	///< records per shard at most, 0 for no limit
+  unsigned long long batch_bytes; ///< bytes per shard at most, 0 for no limit
+  size_t batch_buffer;		///< bytes of records gathered for one write
+  int compress;			///< compression of the descriptor stream
+  int compress_level;		///< compression level, or -1 for the default
+  unsigned long compress_records; ///< records per compressed frame at most
+  int compress_msec;		///< milliseconds a frame is kept open at most
+  char *compress_dict;		///< zstd dictionary file, or NULL
+  char *trace;			///< callback trace file, or NULL
+  boolean nbest_compact;	///< N-best as a word table and arrays
+} json_conf = { STDOUT_FILENO, NULL, -1, 0, 0, FALSE, 0, 0, NULL, 0, 1048576, NULL, 4194304, 0, FIELDS_FULL, NULL, 0, 0, -1, -1, TRUE, NULL, NULL, 0, 0, 4194304, 0, -1, 64, 1000, NULL, NULL, FALSE };
+
+/**
+ * Record encodings.  FORMAT_CBOR writes the same structure as CBOR
+ * (RFC 8949) with containers of indefinite length, each record framed
+ * by its length in 4 bytes, big endian, instead of a newline.
+ */
+enum { FORMAT_JSON, FORMAT_CBOR };
+#define IS_CBOR (json_conf.format == FORMAT_CBOR)
+
+/**
+ * How floats are written in JSON.  FLOATS_FULL writes 17 significant
+ * digits as parson did; FLOATS_SHORTEST writes the shortest digits
+ * that read back to the same single-precision value, which all the
+ * scores of Julius are.
+ */
+enum { FLOATS_FULL, FLOATS_SHORTEST };
+
+/* overflow policies of the writer thread queue */
+enum { OVERFLOW_BLOCK, OVERFLOW_DROP_OLDEST, OVERFLOW_DROP_NEWEST };
+static const char *overflow_name[] = { "block", "drop-oldest", "drop-newest" };
+
+/**
+ * Heap accounting.
+ *
+ * All memory of the plugin is taken through json_malloc(),
+ * json_realloc() and json_free(), which put the size in front of each
+ * block and keep count of the bytes live, their peak, and the blocks
+ * allocated and freed, for the summary of metricsinterval and for the
+ * metrics.  A plugin that keeps growing in a long run shows here,
+ * apart from the memory of Julius.
+ */
+#define HEAP_HEADER 16		///< keeps the alignment of mymalloc()
+
+static struct {
+  unsigned long allocs;		///< blocks allocated or reallocated
+  unsigned long frees;
+  size_t bytes;			///< bytes live
+  size_t peak;			///< high-water mark of @a bytes
+} heap = { 0, 0, 0, 0 };
+
+#define HEAP_LOAD(P) __atomic_load_n(P, __ATOMIC_RELAXED)
+
+/* count @a n more bytes live, or fewer when negative */
 static void
-json_init()
+heap_count(long n)
 {
-  if (root_value != NULL) json_value_free(root_value);
-  root_value = json_value_init_object();
-  root_object = json_value_get_object(root_value);
-  return;
+  size_t bytes, peak;
+
+  __atomic_fetch_add(&(heap.allocs), 1, __ATOMIC_RELAXED);
+  bytes = __atomic_add_fetch(&(heap.bytes), n, __ATOMIC_RELAXED);
+  peak = HEAP_LOAD(&(heap.peak));
+  while (bytes > peak && ! __atomic_compare_exchange_n(&(heap.peak), &peak, bytes, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void *
+json_malloc(size_t size)
+{
+  char *p;
+
+  p = (char *)mymalloc(size + HEAP_HEADER);
+  *(size_t *)p = size;
+  heap_count(size);
+  return p + HEAP_HEADER;
+}
+
+static void *
+json_realloc(void *ptr, size_t size)
+{
+  char *p;
+  size_t old;
+
+  if (ptr == NULL) return json_malloc(size);
+  p = (char *)ptr - HEAP_HEADER;
+  old = *(size_t *)p;
+  p = (char *)myrealloc(p, size + HEAP_HEADER);
+  *(size_t *)p = size;
+  heap_count((long)size - (long)old);
+  return p + HEAP_HEADER;
 }
 
-#ifdef CHARACTER_CONVERSION
-#define MAXBUFLEN 4096 ///< Maximum line length of a message sent from a client
-static char inbuf[MAXBUFLEN];
-static char outbuf[MAXBUFLEN];
 static void
-output(char *fmt, ...)
+json_free(void *ptr)
 {
-  va_list ap;
-  int ret;
-  char *buf;
+  char *p;
 
-  va_start(ap,fmt);
-  ret = vsnprintf(inbuf, MAXBUFLEN, fmt, ap);
-  va_end(ap);
-  if (ret > 0) {		/* success */
-    printf("%s", charconv(inbuf, outbuf, MAXBUFLEN));
-    fflush(stdout);
+  if (ptr == NULL) return;
+  p = (char *)ptr - HEAP_HEADER;
+  __atomic_fetch_add(&(heap.frees), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&(heap.bytes), *(size_t *)p, __ATOMIC_RELAXED);
+  myfree(p);
+}
+
+/**
+ * Per-utterance arena.
+ *
+ * Every buffer used to build a record is carved out of the arena and
+ * the whole arena is released at once in json_init().  When an
+ * utterance needed more than one chunk, the chunks are merged into a
+ * single one of the high-water size, so the next utterance of the
+ * same size does not touch the heap at all.
+ */
+#define JSON_ARENA_CHUNK 65536
+
+typedef struct __json_arena_chunk__ {
+  struct __json_arena_chunk__ *next;
+  size_t size;			///< bytes available in this chunk
+  size_t used;			///< bytes carved from this chunk
+} JSONArenaChunk;
+
+#define ARENA_DATA(C) ((char *)((C) + 1))
+
+typedef struct {
+  JSONArenaChunk *head;		///< chunk currently carved from
+  size_t bytes;			///< bytes carved in this utterance
+  unsigned long allocs;		///< regions carved in this utterance
+  unsigned long mallocs;	///< chunks taken from heap in this utterance
+  size_t peak;			///< high-water mark of @a bytes
+} JSONArena;
+
+static JSONArenaChunk *
+arena_chunk_new(size_t size)
+{
+  JSONArenaChunk *c;
+
+  c = (JSONArenaChunk *)json_malloc(sizeof(JSONArenaChunk) + size);
+  c->size = size;
+  c->used = 0;
+  c->next = NULL;
+  return c;
+}
+
+static char *
+arena_alloc(JSONArena *a, size_t n)
+{
+  JSONArenaChunk *c;
+  char *p;
+
+  c = a->head;
+  if (c == NULL || c->size - c->used < n) {
+    c = arena_chunk_new((n > JSON_ARENA_CHUNK) ? n : JSON_ARENA_CHUNK);
+    c->next = a->head;
+    a->head = c;
+    a->mallocs++;
+  }
+  p = ARENA_DATA(c) + c->used;
+  c->used += n;
+  a->bytes += n;
+  a->allocs++;
+  return p;
+}
+
+/* grow the last carved region in place if it is at the top of the chunk */
+static boolean
+arena_extend(JSONArena *a, char *p, size_t size, size_t n)
+{
+  JSONArenaChunk *c = a->head;
+
+  if (c == NULL || p + size != ARENA_DATA(c) + c->used) return FALSE;
+  if (c->size - c->used < n) return FALSE;
+  c->used += n;
+  a->bytes += n;
+  return TRUE;
+}
+
+/* release everything carved since the last reset */
+static void
+arena_reset(JSONArena *a)
+{
+  JSONArenaChunk *c, *next;
+  size_t size;
+
+  if (a->bytes > a->peak) a->peak = a->bytes;
+  if (a->head != NULL && a->head->next != NULL) {
+    size = 0;
+    for(c=a->head;c;c=next) {
+      next = c->next;
+      size += c->size;
+      json_free(c);
+    }
+    a->head = arena_chunk_new(size);
+  } else if (a->head != NULL) {
+    a->head->used = 0;
+  }
+  a->bytes = 0;
+  a->allocs = 0;
+  a->mallocs = 0;
+}
+
+/**
+ * Append-only JSON writer.
+ *
+ * Values are serialized straight into @a buf as the callbacks fire.
+ * The buffer of a record member lives in the arena, and as a writer
+ * is usually the last one carved while it is being filled, it grows
+ * in place.  A writer without an arena keeps its own heap buffer.
+ */
+#define JSON_MAXDEPTH 16
+
+typedef struct {
+  char *buf;			///< serialized bytes
+  size_t len;			///< bytes used in @a buf
+  size_t size;			///< bytes allocated for @a buf
+  int depth;			///< current container depth
+  boolean first[JSON_MAXDEPTH];	///< TRUE until a container gets its first element
+  boolean keyed;		///< a key was just written, value follows
+  JSONArena *arena;		///< arena to carve @a buf from, or NULL
+} JSONWriter;
+
+static void
+jw_reset(JSONWriter *w)
+{
+  w->len = 0;
+  w->depth = 0;
+  w->first[0] = TRUE;
+  w->keyed = FALSE;
+}
+
+static void
+jw_reserve(JSONWriter *w, size_t n)
+{
+  size_t size;
+  char *p;
+
+  if (w->len + n <= w->size) return;
+  size = (w->size > 0) ? w->size : 256;
+  while (size < w->len + n) size *= 2;
+  if (w->arena == NULL) {
+    w->buf = json_realloc(w->buf, size);
+    w->size = size;
+    return;
+  }
+  if (w->buf != NULL && arena_extend(w->arena, w->buf, w->size, size - w->size)) {
+    w->size = size;
+    return;
+  }
+  p = arena_alloc(w->arena, size);
+  if (w->len > 0) memcpy(p, w->buf, w->len);
+  w->buf = p;
+  w->size = size;
+}
+
+/* forget the buffer, which has been released with the arena */
+static void
+jw_drop(JSONWriter *w)
+{
+  w->buf = NULL;
+  w->len = w->size = 0;
+}
+
+static void
+jw_write(JSONWriter *w, const char *data, size_t len)
+{
+  jw_reserve(w, len);
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+}
+
+/**
+ * Put the head of a CBOR data item of @a major type with argument @a v
+ * into @a p, which needs 9 bytes.  Returns the number of bytes.
+ */
+static size_t
+cbor_head(unsigned char *p, int major, unsigned long long v)
+{
+  int i, n;
+
+  major <<= 5;
+  if (v < 24) {
+    p[0] = major | v;
+    return 1;
+  }
+  if (v <= 0xff) {
+    p[0] = major | 24;
+    n = 1;
+  } else if (v <= 0xffff) {
+    p[0] = major | 25;
+    n = 2;
+  } else if (v <= 0xffffffffULL) {
+    p[0] = major | 26;
+    n = 4;
+  } else {
+    p[0] = major | 27;
+    n = 8;
+  }
+  for(i=n;i>0;i--) {
+    p[i] = v & 0xff;
+    v >>= 8;
+  }
+  return n + 1;
+}
+
+static void
+jw_cbor_head(JSONWriter *w, int major, unsigned long long v)
+{
+  jw_reserve(w, 9);
+  w->len += cbor_head((unsigned char *)w->buf + w->len, major, v);
+}
+
+/* put a separator before the next value unless it is the first one */
+static void
+jw_sep(JSONWriter *w)
+{
+  if (IS_CBOR) return;
+  if (w->keyed) {
+    w->keyed = FALSE;
+    return;
+  }
+  if (w->first[w->depth]) {
+    w->first[w->depth] = FALSE;
+  } else {
+    jw_reserve(w, 1);
+    w->buf[w->len++] = ',';
+  }
+}
+
+static void
+jw_open(JSONWriter *w, char c, unsigned char cbor)
+{
+  jw_sep(w);
+  jw_reserve(w, 1);
+  w->buf[w->len++] = IS_CBOR ? cbor : c;
+  w->first[++w->depth] = TRUE;
+}
+
+static void
+jw_close(JSONWriter *w, char c)
+{
+  jw_reserve(w, 1);
+  w->buf[w->len++] = IS_CBOR ? 0xff : c;
+  w->depth--;
+}
+
+#define jw_object_begin(W) jw_open(W, '{', 0xbf)
+#define jw_object_end(W) jw_close(W, '}')
+#define jw_array_begin(W) jw_open(W, '[', 0x9f)
+#define jw_array_end(W) jw_close(W, ']')
+
+/* key names are plain ASCII literals and need no escaping */
+static void
+jw_key(JSONWriter *w, const char *key)
+{
+  size_t len = strlen(key);
+
+  if (IS_CBOR) {
+    jw_cbor_head(w, 3, len);
+    jw_write(w, key, len);
+    return;
+  }
+  jw_sep(w);
+  jw_reserve(w, len + 3);
+  w->buf[w->len++] = '"';
+  memcpy(w->buf + w->len, key, len);
+  w->len += len;
+  w->buf[w->len++] = '"';
+  w->buf[w->len++] = ':';
+  w->keyed = TRUE;
+}
+
+/**
+ * String escaping.
+ *
+ * Words and sentences are mostly multi-byte UTF-8, which needs no
+ * escaping in JSON, so a string is copied in spans up to the next
+ * byte that does: a control character, '"', '\\', or '/' unless
+ * "noslash" is given.  The spans are found 16 or 32 bytes at a time
+ * with SSE2 or AVX2 where available.  Each span is checked to be
+ * valid UTF-8 on the way, and an invalid sequence, as from a
+ * dictionary in another encoding, is replaced by U+FFFD as the
+ * Unicode standard recommends, so that records always parse.
+ */
+#define needs_escape(c) ((c) < 0x20 || (c) == '"' || (c) == '\\' || ((c) == '/' && json_conf.slash))
+
+static size_t
+escape_span_scalar(const unsigned char *p, size_t len)
+{
+  size_t i;
+
+  for(i=0;i<len;i++) if (needs_escape(p[i])) break;
+  return i;
+}
+
+#ifdef HAVE_JSON_SIMD
+/* bytes of a block that need escaping, as a bit mask */
+#define ESCAPE_MASK(BITS, X) ({						\
+      __m##BITS##i x_ = (X);						\
+      __m##BITS##i m_ = _mm##BITS##_or_si##BITS(_mm##BITS##_cmpeq_epi8(x_, quote), _mm##BITS##_cmpeq_epi8(x_, bslash)); \
+      m_ = _mm##BITS##_or_si##BITS(m_, _mm##BITS##_cmpeq_epi8(_mm##BITS##_min_epu8(x_, ctrl), x_)); \
+      if (json_conf.slash) m_ = _mm##BITS##_or_si##BITS(m_, _mm##BITS##_cmpeq_epi8(x_, slash)); \
+      (unsigned int)_mm##BITS##_movemask_epi8(m_); })
+#define _mm128_or_si128 _mm_or_si128
+#define _mm128_cmpeq_epi8 _mm_cmpeq_epi8
+#define _mm128_min_epu8 _mm_min_epu8
+#define _mm128_movemask_epi8 _mm_movemask_epi8
+
+static size_t
+escape_span_sse2(const unsigned char *p, size_t len)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i ctrl = _mm_set1_epi8(0x1f);
+  unsigned int mask;
+  size_t i;
+
+  for(i=0;i+16<=len;i+=16) {
+    mask = ESCAPE_MASK(128, _mm_loadu_si128((const __m128i *)(p + i)));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + escape_span_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+escape_span_avx2(const unsigned char *p, size_t len)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i slash = _mm256_set1_epi8('/');
+  const __m256i ctrl = _mm256_set1_epi8(0x1f);
+  unsigned int mask;
+  size_t i;
+
+  for(i=0;i+32<=len;i+=32) {
+    mask = ESCAPE_MASK(256, _mm256_loadu_si256((const __m256i *)(p + i)));
+    if (mask != 0) return i + __builtin_ctz(mask);
   }
+  return i + escape_span_sse2(p + i, len - i);
 }
+
+static size_t (*escape_span)(const unsigned char *p, size_t len) = escape_span_sse2;
 #else
-#define output printf
+#define escape_span escape_span_scalar
+#endif
+
+/* choose the widest span finder the CPU has */
+static void
+escape_init()
+{
+#ifdef HAVE_JSON_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) escape_span = escape_span_avx2;
 #endif
+}
+
+/**
+ * Check the UTF-8 sequence at @a p, of @a len bytes at most.  Returns
+ * its length if it is valid, or minus the length of the maximal
+ * subpart to replace if not.
+ */
+static int
+utf8_check(const unsigned char *p, size_t len)
+{
+  unsigned char lo = 0x80, hi = 0xbf;
+  int n, i;
+
+  if (p[0] < 0x80) return 1;
+  if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+    n = 2;
+  } else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+    n = 3;
+    if (p[0] == 0xe0) lo = 0xa0;	/* overlong */
+    if (p[0] == 0xed) hi = 0x9f;	/* surrogates */
+  } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+    n = 4;
+    if (p[0] == 0xf0) lo = 0x90;	/* overlong */
+    if (p[0] == 0xf4) hi = 0x8f;	/* beyond U+10FFFF */
+  } else {
+    return -1;
+  }
+  for(i=1;i<n;i++) {
+    if ((size_t)i >= len || p[i] < lo || p[i] > hi) return -i;
+    lo = 0x80;
+    hi = 0xbf;
+  }
+  return n;
+}
+
+/**
+ * Copy @a len bytes of UTF-8 to @a q, replacing invalid sequences by
+ * U+FFFD.  Returns the number of bytes written.
+ */
+static size_t
+utf8_copy(char *q, const unsigned char *p, size_t len)
+{
+  size_t i, done, n;
+  int k;
+
+  n = 0;
+  done = 0;
+  for(i=0;i<len;) {
+    if (p[i] < 0x80) {
+      i++;
+      continue;
+    }
+    k = utf8_check(p + i, len - i);
+    if (k > 0) {
+      i += k;
+      continue;
+    }
+    memcpy(q + n, p + done, i - done);
+    n += i - done;
+    memcpy(q + n, "\xef\xbf\xbd", 3);
+    n += 3;
+    i += -k;
+    done = i;
+  }
+  memcpy(q + n, p + done, len - done);
+  return n + len - done;
+}
+
+/**
+ * Escape @a str into @a dst as a quoted JSON string, in the same way
+ * as parson did, including "\/" unless "noslash" is given.  @a dst
+ * needs strlen(str) * 6 + 2 bytes.  Returns the number of bytes
+ * written.
+ */
+static size_t
+json_escape(char *dst, const char *str)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char *p = (const unsigned char *)str;
+  size_t len, n;
+  char *q = dst;
+
+  len = strlen(str);
+  *q++ = '"';
+  while (len > 0) {
+    n = escape_span(p, len);
+    q += utf8_copy(q, p, n);
+    p += n;
+    len -= n;
+    if (len == 0) break;
+    switch(*p) {
+    case '"':  *q++ = '\\'; *q++ = '"'; break;
+    case '\\': *q++ = '\\'; *q++ = '\\'; break;
+    case '/':  *q++ = '\\'; *q++ = '/'; break;
+    case '\b': *q++ = '\\'; *q++ = 'b'; break;
+    case '\f': *q++ = '\\'; *q++ = 'f'; break;
+    case '\n': *q++ = '\\'; *q++ = 'n'; break;
+    case '\r': *q++ = '\\'; *q++ = 'r'; break;
+    case '\t': *q++ = '\\'; *q++ = 't'; break;
+    default:
+      *q++ = '\\'; *q++ = 'u'; *q++ = '0'; *q++ = '0';
+      *q++ = hex[*p >> 4]; *q++ = hex[*p & 0xf];
+    }
+    p++;
+    len--;
+  }
+  *q++ = '"';
+  return q - dst;
+}
+
+/**
+ * Encode @a str as a string value of the record format into @a dst,
+ * which needs strlen(str) * 6 + 9 bytes.  Returns the number of bytes.
+ */
+static size_t
+string_encode(char *dst, const char *str)
+{
+  size_t len, n, m;
 
-#define jsonify(KEY,VALUE) output("\"%s\":\"%s\"", KEY, VALUE)
-#define jsonify_fmt(KEY,VALUE,FMT) output("\"%s\":\"" FMT "\"", KEY, VALUE)
-#define jsonify_integer(KEY,VALUE) output("\"%s\":%d", KEY, VALUE)
-#define jsonify_float(KEY,VALUE) output("\"%s\":%1.17g", KEY, VALUE)
-#define jsonify_string(KEY,VALUE) output("\"%s\":\"%s\"", KEY, VALUE)
-#define jsonify_boolean(KEY,VALUE) do { \
-       if (VALUE) output("\"%s\":true", KEY); \
-       else output("\"%s\":false", KEY); \
-   } while (0)
-#define jsonify_sep() output(", ")
+  if (! IS_CBOR) return json_escape(dst, str);
+  len = strlen(str);
+  /* the text goes after the longest head, and moves up to its own */
+  m = utf8_copy(dst + 9, (const unsigned char *)str, len);
+  n = cbor_head((unsigned char *)dst, 3, m);
+  memmove(dst + n, dst + 9, m);
+  return n + m;
+}
 
 static void
-nop(void)
+jw_string(JSONWriter *w, const char *str)
 {
-  fflush(stdout);
+  jw_sep(w);
+  jw_reserve(w, strlen(str) * 6 + 9);
+  w->len += string_encode(w->buf + w->len, str);
 }
 
-static boolean
-opt_json(Jconf *jconf, char *arg[], int argnum)
+/* a float in single precision when that is exact, else in double */
+static void
+jw_cbor_float(JSONWriter *w, double v)
 {
-  outout_json_flag = 1;
-  return TRUE;
+  unsigned long long bits;
+  unsigned char *p;
+  float f;
+  uint32_t b32;
+  int i, n;
+
+  jw_reserve(w, 9);
+  p = (unsigned char *)w->buf + w->len;
+  f = (float)v;
+  if ((double)f == v) {
+    memcpy(&b32, &f, 4);
+    bits = b32;
+    p[0] = 0xfa;
+    n = 4;
+  } else {
+    memcpy(&bits, &v, 8);
+    p[0] = 0xfb;
+    n = 8;
+  }
+  for(i=n;i>0;i--) {
+    p[i] = bits & 0xff;
+    bits >>= 8;
+  }
+  w->len += n + 1;
 }
 
-int
-initialize()
+/**
+ * Shortest decimal of a single-precision float, after Ryu (U. Adams,
+ * "Ryu: fast float-to-string conversion", PLDI 2018).
+ *
+ * The bounds of the interval of decimals that read back to the same
+ * float are scaled by a power of 10 with a fixed-point multiply, and
+ * digits are removed while the bounds still differ.  The multipliers
+ * are 5^i and 2^k/5^q normalized to 61 and 59 bits; they are computed
+ * once by f2s_init() with 128-bit integers instead of being listed.
+ * Without 128-bit integers, as on 32-bit targets, the digits are the
+ * fewest that printf() gives and strtof() reads back to the same
+ * float instead.
+ */
+#ifdef __SIZEOF_INT128__
+#define F2S_POW5_INV_BITCOUNT 59
+#define F2S_POW5_BITCOUNT 61
+#define F2S_POW5_INV_NUM 31
+#define F2S_POW5_NUM 47
+
+static uint64_t f2s_pow5_inv[F2S_POW5_INV_NUM];
+static uint64_t f2s_pow5[F2S_POW5_NUM];
+
+/* bits of 5^e, that is ceil(log2(5^e)), for e > 0 */
+#define pow5bits(e) ((int)(((uint32_t)(e) * 1217359) >> 19) + 1)
+/* floor(log10(2^e)) and floor(log10(5^e)) */
+#define log10pow2(e) ((uint32_t)(((uint32_t)(e) * 78913) >> 18))
+#define log10pow5(e) ((uint32_t)(((uint32_t)(e) * 732923) >> 20))
+
+static void
+f2s_init()
 {
-  j_add_option("-json", 0, 0, "enable json extension", opt_json);
-  setvbuf(stdout, (char *)NULL, _IONBF, 0);
-  json_init();
-  return 0;
+  unsigned __int128 p5 = 1;
+  int i, b;
+
+  for(i=0;i<F2S_POW5_NUM;i++) {
+    b = pow5bits(i) - F2S_POW5_BITCOUNT;
+    f2s_pow5[i] = (uint64_t)((b > 0) ? p5 >> b : p5 << -b);
+    if (i < F2S_POW5_INV_NUM) {
+      /* ceil(2^b / 5^i), where 2^128 itself does not fit */
+      b = pow5bits(i) - 1 + F2S_POW5_INV_BITCOUNT;
+      f2s_pow5_inv[i] = (uint64_t)(((b < 128) ? ((unsigned __int128)1 << b) : ~(unsigned __int128)0) / p5 + 1);
+    }
+    p5 *= 5;
+  }
 }
 
-int
-get_plugin_info(int opcode, char *buf, int buflen)
+/* (m * factor) >> shift, for shift > 32 */
+static inline uint32_t
+f2s_mulshift(uint32_t m, uint64_t factor, int shift)
+{
+  uint64_t lo = (uint64_t)m * (uint32_t)factor;
+  uint64_t hi = (uint64_t)m * (uint32_t)(factor >> 32);
+
+  return (uint32_t)(((lo >> 32) + hi) >> (shift - 32));
+}
+
+static inline boolean
+f2s_multiple_of_pow5(uint32_t v, uint32_t p)
+{
+  uint32_t n = 0;
+
+  while (v % 5 == 0) {
+    v /= 5;
+    n++;
+  }
+  return n >= p;
+}
+
+/**
+ * Decimal digits and exponent of the shortest representation of a
+ * positive float of mantissa @a mant and biased exponent @a bexp.
+ */
+static uint32_t
+f2s_digits(uint32_t mant, uint32_t bexp, int *exp10)
+{
+  uint32_t m2, mv, mp, mm, mmshift, vr, vp, vm, q, output;
+  int e2, e10, i, k, j, removed;
+  boolean even, vm_zeros, vr_zeros;
+  int last;
+
+  if (bexp == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = mant;
+  } else {
+    e2 = (int)bexp - 127 - 23 - 2;
+    m2 = (1u << 23) | mant;
+  }
+  even = (m2 & 1) == 0;
+
+  /* the value and the halfway points to its neighbors, times 4 */
+  mv = 4 * m2;
+  mp = 4 * m2 + 2;
+  mmshift = (mant != 0 || bexp <= 1);
+  mm = 4 * m2 - 1 - mmshift;
+
+  vm_zeros = vr_zeros = FALSE;
+  last = 0;
+  if (e2 >= 0) {
+    q = log10pow2(e2);
+    e10 = q;
+    k = F2S_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+    i = -e2 + (int)q + k;
+    vr = f2s_mulshift(mv, f2s_pow5_inv[q], i);
+    vp = f2s_mulshift(mp, f2s_pow5_inv[q], i);
+    vm = f2s_mulshift(mm, f2s_pow5_inv[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      /* one removed digit is needed even without the loop below */
+      k = F2S_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+      last = f2s_mulshift(mv, f2s_pow5_inv[q - 1], -e2 + (int)q - 1 + k) % 10;
+    }
+    if (q <= 9) {
+      /* only one of mp, mv and mm can be a multiple of 5 */
+      if (mv % 5 == 0) {
+	vr_zeros = f2s_multiple_of_pow5(mv, q);
+      } else if (even) {
+	vm_zeros = f2s_multiple_of_pow5(mm, q);
+      } else {
+	vp -= f2s_multiple_of_pow5(mp, q);
+      }
+    }
+  } else {
+    q = log10pow5(-e2);
+    e10 = (int)q + e2;
+    i = -e2 - (int)q;
+    k = pow5bits(i) - F2S_POW5_BITCOUNT;
+    j = (int)q - k;
+    vr = f2s_mulshift(mv, f2s_pow5[i], j);
+    vp = f2s_mulshift(mp, f2s_pow5[i], j);
+    vm = f2s_mulshift(mm, f2s_pow5[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = (int)q - 1 - (pow5bits(i + 1) - F2S_POW5_BITCOUNT);
+      last = f2s_mulshift(mv, f2s_pow5[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      /* mv has two trailing zero bits, mp one, and mm one if mmshift */
+      vr_zeros = TRUE;
+      if (even) {
+	vm_zeros = (mmshift == 1);
+      } else {
+	vp--;
+      }
+    } else if (q < 31) {
+      vr_zeros = (mv & ((1u << (q - 1)) - 1)) == 0;
+    }
+  }
+
+  /* remove digits while the bounds differ */
+  removed = 0;
+  if (vm_zeros || vr_zeros) {
+    while (vp / 10 > vm / 10) {
+      vm_zeros &= (vm % 10 == 0);
+      vr_zeros &= (last == 0);
+      last = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_zeros) {
+      while (vm % 10 == 0) {
+	vr_zeros &= (last == 0);
+	last = vr % 10;
+	vr /= 10;
+	vp /= 10;
+	vm /= 10;
+	removed++;
+      }
+    }
+    /* round half to even when exactly halfway */
+    if (vr_zeros && last == 5 && vr % 2 == 0) last = 4;
+    output = vr + ((vr == vm && (! even || ! vm_zeros)) || last >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      last = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || last >= 5);
+  }
+  *exp10 = e10 + removed;
+  return output;
+}
+
+#else /* ! __SIZEOF_INT128__ */
+
+static void
+f2s_init()
+{
+}
+
+static uint32_t
+f2s_digits(uint32_t mant, uint32_t bexp, int *exp10)
+{
+  char buf[32], *p;
+  uint32_t bits, output;
+  float f;
+  int prec;
+
+  bits = (bexp << 23) | mant;
+  memcpy(&f, &bits, 4);
+  /* 9 digits always read back */
+  for(prec=1;prec<9;prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, f);
+    if (strtof(buf, NULL) == f) break;
+  }
+  snprintf(buf, sizeof(buf), "%.*e", prec - 1, f);
+  output = 0;
+  for(p=buf;*p!='e';p++) {
+    if (*p >= '0' && *p <= '9') output = output * 10 + (*p - '0');
+  }
+  *exp10 = atoi(p + 1) - (prec - 1);
+  return output;
+}
+
+#endif /* __SIZEOF_INT128__ */
+
+/* put the decimal digits of @a u at @a p, and return their number */
+static int
+put_digits(char *p, unsigned long long u)
+{
+  char tmp[24];
+  int n = 0, i;
+
+  do {
+    tmp[n++] = '0' + (u % 10);
+    u /= 10;
+  } while (u > 0);
+  for(i=0;i<n;i++) p[i] = tmp[n - 1 - i];
+  return n;
+}
+
+/**
+ * Write a finite float in its shortest form at @a p, which needs 16
+ * bytes, as JavaScript would: plain decimals from 1e-6 up to 1e21,
+ * else an exponent.  Returns the length.
+ */
+static int
+f2s_format(char *p, float f)
+{
+  char d[12];
+  uint32_t bits, digits;
+  int n, len, exp10, dp, i;
+
+  memcpy(&bits, &f, 4);
+  n = 0;
+  if (bits >> 31) p[n++] = '-';
+  if ((bits & 0x7fffffff) == 0) {
+    p[n++] = '0';
+    return n;
+  }
+  digits = f2s_digits(bits & 0x7fffff, (bits >> 23) & 0xff, &exp10);
+  len = put_digits(d, digits);
+  dp = len + exp10;		/* digits before the decimal point */
+  if (exp10 >= 0 && dp <= 21) {
+    memcpy(p + n, d, len);
+    n += len;
+    for(i=0;i<exp10;i++) p[n++] = '0';
+  } else if (dp > 0 && dp <= 21) {
+    memcpy(p + n, d, dp);
+    n += dp;
+    p[n++] = '.';
+    memcpy(p + n, d + dp, len - dp);
+    n += len - dp;
+  } else if (dp > -6 && dp <= 0) {
+    p[n++] = '0';
+    p[n++] = '.';
+    for(i=dp;i<0;i++) p[n++] = '0';
+    memcpy(p + n, d, len);
+    n += len;
+  } else {
+    p[n++] = d[0];
+    if (len > 1) {
+      p[n++] = '.';
+      memcpy(p + n, d + 1, len - 1);
+      n += len - 1;
+    }
+    p[n++] = 'e';
+    if (dp - 1 < 0) p[n++] = '-';
+    n += put_digits(p + n, (dp - 1 < 0) ? 1 - dp : dp - 1);
+  }
+  return n;
+}
+
+/**
+ * Write @a v rounded to @a digits decimal places at @a p, which needs
+ * 32 bytes, without trailing zeros.  Returns the length.
+ */
+static int
+fixed_format(char *p, double v, int digits)
+{
+  static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  unsigned long long u, div;
+  long long r;
+  int n, i;
+
+  r = llround(v * scale[digits]);
+  if (r > 999999999999999LL || r < -999999999999999LL) {
+    /* too large for the integer path */
+    return snprintf(p, 32, "%.*f", digits, v);
+  }
+  n = 0;
+  if (r < 0) p[n++] = '-';
+  u = (r < 0) ? -r : r;
+  for(div=1,i=0;i<digits;i++) div *= 10;
+  n += put_digits(p + n, u / div);
+  u %= div;
+  if (u > 0) {
+    /* drop trailing zeros of the fraction */
+    while (u % 10 == 0) {
+      u /= 10;
+      div /= 10;
+    }
+    p[n++] = '.';
+    for(div/=10;div>u && div>1;div/=10) p[n++] = '0';
+    n += put_digits(p + n, u);
+  }
+  return n;
+}
+
+/**
+ * Write a float.  @a digits fixes the number of decimal places, or is
+ * -1 to write it as "floats=" tells.
+ */
+static void
+jw_float(JSONWriter *w, double v, int digits)
+{
+  float f;
+
+  if (IS_CBOR) {
+    if (isfinite(v)) {
+      jw_cbor_float(w, v);
+    } else {
+      jw_reserve(w, 1);
+      w->buf[w->len++] = 0xf6;
+    }
+    return;
+  }
+  jw_sep(w);
+  jw_reserve(w, 32);
+  if (! isfinite(v)) {
+    memcpy(w->buf + w->len, "null", 4);
+    w->len += 4;
+  } else if (digits >= 0) {
+    w->len += fixed_format(w->buf + w->len, v, digits);
+  } else if (json_conf.floats == FLOATS_SHORTEST && (double)(f = (float)v) == v) {
+    w->len += f2s_format(w->buf + w->len, f);
+  } else {
+    w->len += snprintf(w->buf + w->len, 32, "%1.17g", v);
+  }
+}
+
+#define jw_number(W,V) jw_float(W, V, -1)
+
+static void
+jw_integer(JSONWriter *w, long v)
+{
+  char tmp[24];
+  char *p = tmp + sizeof(tmp);
+  unsigned long u = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+
+  if (IS_CBOR) {
+    if (v < 0) jw_cbor_head(w, 1, u - 1);
+    else jw_cbor_head(w, 0, u);
+    return;
+  }
+  do {
+    *--p = '0' + (u % 10);
+    u /= 10;
+  } while (u > 0);
+  if (v < 0) *--p = '-';
+  jw_sep(w);
+  jw_write(w, p, tmp + sizeof(tmp) - p);
+}
+
+static void
+jw_boolean(JSONWriter *w, boolean v)
+{
+  if (IS_CBOR) {
+    jw_reserve(w, 1);
+    w->buf[w->len++] = v ? 0xf5 : 0xf4;
+    return;
+  }
+  jw_sep(w);
+  if (v) jw_write(w, "true", 4);
+  else jw_write(w, "false", 5);
+}
+
+/* insert an already serialized value */
+static void
+jw_raw(JSONWriter *w, const char *data, size_t len)
+{
+  jw_sep(w);
+  jw_write(w, data, len);
+}
+
+#define jw_value(W,V) jw_raw(W, (V)->buf, (V)->len)
+
+#define jw_key_string(W,K,V) do { jw_key(W, K); jw_string(W, V); } while (0)
+#define jw_key_number(W,K,V) do { jw_key(W, K); jw_number(W, V); } while (0)
+#define jw_key_score(W,K,V) do { jw_key(W, K); jw_float(W, V, json_conf.scoredigits); } while (0)
+#define jw_key_cm(W,K,V) do { jw_key(W, K); jw_float(W, V, json_conf.cmdigits); } while (0)
+#define jw_key_integer(W,K,V) do { jw_key(W, K); jw_integer(W, V); } while (0)
+#define jw_key_boolean(W,K,V) do { jw_key(W, K); jw_boolean(W, V); } while (0)
+
+/**
+ * Top-level members of a record.
+ *
+ * Each member keeps its own serialized value, and the record lists
+ * them in the order they were first set.  Setting a member again
+ * overwrites its value in place, as the former DOM did.
+ */
+enum {
+  MEMBER_TIME,
+  MEMBER_PASS1,
+  MEMBER_INPUT,
+  MEMBER_RECOGOUT,
+  MEMBER_GMM,
+  MEMBER_SENTENCE,
+  MEMBER_SUCCEEDED,
+  MEMBER_RESULT,
+  MEMBER_GRAPH,
+  MEMBER_CONFNET,
+  MEMBER_SOURCE,
+  MEMBER_LATENCY,
+  MEMBER_SEQ,
+  MEMBER_NUM
+};
+
+/* key of each member, with the separator put before all but the first */
+static const char *member_head[MEMBER_NUM] = {
+  ",\"TIME\":", ",\"PASS1\":", ",\"INPUT\":", ",\"RECOGOUT\":", ",\"GMM\":",
+  ",\"sentence\":", ",\"succeeded\":", ",\"result\":", ",\"GRAPH\":",
+  ",\"CONFNET\":", ",\"SOURCE\":", ",\"LATENCY\":", ",\"SEQ\":"
+};
+/* the same in CBOR, where the heads are key strings only */
+static const char *member_head_cbor[MEMBER_NUM] = {
+  "\x64TIME", "\x65PASS1", "\x65INPUT", "\x68RECOGOUT", "\x63GMM",
+  "\x68sentence", "\x69succeeded", "\x66result", "\x65GRAPH",
+  "\x67" "CONFNET", "\x66SOURCE", "\x67LATENCY", "\x63SEQ"
+};
+
+/* sub-members of "TIME", set one by one from the status callbacks */
+enum { TIME_LISTEN, TIME_STARTREC, TIME_ENDREC, TIME_NUM };
+static const char *time_key[TIME_NUM] = { "LISTEN", "STARTREC", "ENDREC" };
+
+/**
+ * Monotonic time stamps of the stages of an utterance, in nanoseconds,
+ * taken by the callbacks.  A stage that has not been seen is 0.
+ */
+enum {
+  STAMP_READY, STAMP_START, STAMP_STOP, STAMP_PASS1_BEGIN, STAMP_PASS1_END,
+  STAMP_RESULT, STAMP_EMIT, STAMP_NUM
+};
+
+/**
+ * Conversion of dictionary strings to UTF-8.
+ *
+ * Records are UTF-8 whatever "-charconv" gives the text output, so
+ * with "charset=code" the strings a record takes from the dictionary
+ * are converted from that code with iconv: words once per WORD_ID as
+ * they enter the word cache, and the sentence once per record.  Each
+ * engine has a converter of its own, as iconv keeps state.  A byte
+ * that does not convert is passed through, and is replaced by U+FFFD
+ * when the string is escaped.
+ */
+typedef struct {
+#ifdef CHARACTER_CONVERSION
+  iconv_t cd;			///< converter, or (iconv_t)-1 for none
+#endif
+  char *buf;			///< the last converted string
+  size_t size;			///< bytes allocated for @a buf
+} CharConv;
+
+#ifdef CHARACTER_CONVERSION
+static void
+charconv_open(CharConv *c)
+{
+  c->cd = (json_conf.charset != NULL) ? iconv_open("UTF-8", json_conf.charset) : (iconv_t)-1;
+  c->buf = NULL;
+  c->size = 0;
+}
+
+/* grow the buffer of @a c to @a size bytes at least, keeping @a *out in it */
+static void
+charconv_grow(CharConv *c, size_t size, char **out)
+{
+  size_t n = *out - c->buf;
+
+  if (size <= c->size) return;
+  if (size < c->size * 2) size = c->size * 2;
+  c->buf = (char *)json_realloc(c->buf, size);
+  c->size = size;
+  *out = c->buf + n;
+}
+
+/**
+ * Convert @a str to UTF-8.  Returns @a str itself when there is no
+ * converter, or else the buffer of @a c, which the next conversion
+ * overwrites.
+ */
+static const char *
+charconv_utf8(CharConv *c, const char *str)
+{
+  char *in, *out;
+  size_t inleft, outleft;
+
+  if (c->cd == (iconv_t)-1) return str;
+  in = (char *)str;
+  inleft = strlen(str);
+  out = c->buf;
+  /* a byte of EUC-JP or Shift_JIS is 3 bytes of UTF-8 at most */
+  charconv_grow(c, inleft * 3 + 16, &out);
+  iconv(c->cd, NULL, NULL, NULL, NULL);
+  for(;;) {
+    outleft = c->size - (out - c->buf) - 1;
+    if (iconv(c->cd, &in, &inleft, &out, &outleft) != (size_t)-1) break;
+    if (errno == E2BIG || outleft == 0) {
+      charconv_grow(c, c->size * 2, &out);
+    } else {
+      /* invalid or incomplete: pass the byte through */
+      *out++ = *in++;
+      inleft--;
+    }
+  }
+  /* back to the initial shift state */
+  for(;;) {
+    outleft = c->size - (out - c->buf) - 1;
+    if (iconv(c->cd, NULL, NULL, &out, &outleft) != (size_t)-1) break;
+    charconv_grow(c, c->size * 2, &out);
+  }
+  *out = '\0';
+  return c->buf;
+}
+#else
+#define charconv_open(C) ((C)->buf = NULL)
+#define charconv_utf8(C,S) (S)
+#endif
+
+/**
+ * State of the plugin for one recognition engine.
+ *
+ * An application may run several Recog instances in one process, each
+ * on a thread of its own.  Everything a record is built from lives in
+ * the engine it belongs to, which startup() hands to the callbacks as
+ * their data pointer, so engines share nothing mutable but the sinks,
+ * which take records from any thread.
+ */
+typedef struct __json_engine__ {
+  int id;			///< "ENGINE" of its records, in order of startup
+  Recog *recog;
+  char tag[24];			///< "ENGINE" member, encoded
+  size_t tag_len;
+  JSONArena arena;		///< per-utterance arena
+  JSONWriter member[MEMBER_NUM];
+  boolean member_isset[MEMBER_NUM];
+  int member_order[MEMBER_NUM];
+  int member_num;
+  JSONWriter line;		///< a line to write, put together
+  time_t time_value[TIME_NUM];
+  int time_order[TIME_NUM];
+  int time_num;
+  long long stamp[STAMP_NUM];
+  long long stamp_build;	///< nanoseconds spent building members
+  int stamp_msec;		///< length of the input in msec, or -1
+  int frames;			///< length of the input in frames
+  char *source;			///< input file of the last record, or NULL
+  int source_segment;		///< records of the input file so far
+  long source_offset;		///< frames of the input file so far
+  unsigned long seq;		///< "SEQ" of the next record of this engine
+  CharConv conv;		///< dictionary strings to UTF-8
+  struct __word_cache__ *word_cache;
+  struct __interim_state__ *interim_root;
+  JSONWriter interim;		///< interim record being built
+  boolean interim_emitted;	///< interim sent for this input
+  long long interim_last_time;
+  int interim_last_frame;
+  struct __metric_process__ *metric; ///< counters of each process
+  int metric_num;
+  struct __json_trace__ *trace;	///< callback trace, or NULL
+  struct __json_engine__ *next;
+} JSONEngine;
+
+static JSONEngine *engine_root = NULL; ///< all engines, newest first
+static int engine_num = 0;
+static pthread_mutex_t engine_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* engine whose callbacks run on this thread, for result_best_str() */
+static __thread JSONEngine *engine_current = NULL;
+
+/**
+ * Records tell their engine when ENGINE is selected, and always once a
+ * second engine has started, since their SEQ and the outputs they share
+ * cannot be told apart otherwise.
+ */
+#define ENGINE_TAGGED (__atomic_load_n(&engine_num, __ATOMIC_ACQUIRE) > 1 || FIELD_ON(FIELD_ENGINE))
+
+/* the engine of a callback, which runs on this thread from now on */
+static JSONEngine *
+engine_enter(void *data)
+{
+  engine_current = (JSONEngine *)data;
+  return engine_current;
+}
+
+/* start (re)writing a top-level member */
+static JSONWriter *
+member_begin(JSONEngine *e, int id)
+{
+  if (! e->member_isset[id]) {
+    e->member_isset[id] = TRUE;
+    e->member_order[e->member_num++] = id;
+  }
+  jw_reset(&(e->member[id]));
+  return &(e->member[id]);
+}
+
+/* current time in nanoseconds on a monotonic clock */
+static long long
+json_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define json_stamp(e, id) ((e)->stamp[id] = json_clock())
+
+/* time since @a t0 went into building members */
+#define json_stamp_build(e, t0) ((e)->stamp_build += json_clock() - (t0))
+
+static void
+json_init(JSONEngine *e)
+{
+  int i;
+
+  for(i=0;i<MEMBER_NUM;i++) {
+    e->member_isset[i] = FALSE;
+    jw_drop(&(e->member[i]));
+    e->member[i].arena = &(e->arena);
+  }
+  arena_reset(&(e->arena));
+  e->member_num = 0;
+  e->time_num = 0;
+  memset(e->stamp, 0, sizeof(e->stamp));
+  e->stamp_build = 0;
+  e->stamp_msec = -1;
+  e->frames = 0;
+  return;
+}
+
+static void
+json_set_time(JSONEngine *e, int id)
+{
+  JSONWriter *jw;
+  int i;
+
+  for(i=0;i<e->time_num;i++) if (e->time_order[i] == id) break;
+  if (i == e->time_num) e->time_order[e->time_num++] = id;
+  e->time_value[id] = time(NULL);
+
+  if (! FIELD_ON(FIELD_TIME)) return;
+  jw = member_begin(e, MEMBER_TIME);
+  jw_object_begin(jw);
+  for(i=0;i<e->time_num;i++) {
+    jw_key_integer(jw, time_key[e->time_order[i]], e->time_value[e->time_order[i]]);
+  }
+  jw_object_end(jw);
+}
+
+/* put a duration between two stamps, unless one of them is missing */
+static void
+jw_key_span(JSONWriter *jw, long long *stamp, const char *key, int from, int to)
+{
+  if (stamp[from] != 0 && stamp[to] != 0) jw_key_integer(jw, key, stamp[to] - stamp[from]);
+}
+
+/**
+ * Set "LATENCY" from the stamps, just before the record is output.
+ * Durations are in nanoseconds: SPEECH from speech start to stop,
+ * PASS1 and PASS2 for each pass, EMIT from the end of speech to the
+ * output of the record, and BUILD for the time the callbacks spent
+ * building the record.  RTF is the time from the beginning of the 1st
+ * pass to the output, divided by the length of the input.
+ */
+static void
+json_set_latency(JSONEngine *e)
+{
+  JSONWriter *jw;
+
+  json_stamp(e, STAMP_EMIT);
+  if (! FIELD_ON(FIELD_LATENCY)) return;
+  jw = member_begin(e, MEMBER_LATENCY);
+  jw_object_begin(jw);
+  jw_key_span(jw, e->stamp, "SPEECH", STAMP_START, STAMP_STOP);
+  jw_key_span(jw, e->stamp, "PASS1", STAMP_PASS1_BEGIN, STAMP_PASS1_END);
+  jw_key_span(jw, e->stamp, "PASS2", STAMP_PASS1_END, STAMP_RESULT);
+  jw_key_span(jw, e->stamp, "EMIT", STAMP_STOP, STAMP_EMIT);
+  jw_key_integer(jw, "BUILD", e->stamp_build);
+  if (e->stamp_msec > 0 && e->stamp[STAMP_PASS1_BEGIN] != 0) {
+    jw_key_number(jw, "RTF", (e->stamp[STAMP_EMIT] - e->stamp[STAMP_PASS1_BEGIN]) / (e->stamp_msec * 1000000.0));
+  }
+  jw_object_end(jw);
+}
+
+#define RECORD_IOV_MAX (MEMBER_NUM * 2 + 3)
+
+/**
+ * List the pieces of the record in @a iov without copying them.
+ * Returns the number of pieces, and the record length in @a len.
+ */
+static int
+json_record_iov(JSONEngine *e, struct iovec *iov, size_t *len)
+{
+  const char *head;
+  boolean tagged;
+  int i, n;
+
+  n = 0;
+  iov[n].iov_base = IS_CBOR ? "\xbf" : "{";
+  iov[n++].iov_len = 1;
+  tagged = ENGINE_TAGGED;
+  if (tagged) {
+    iov[n].iov_base = e->tag;
+    iov[n++].iov_len = e->tag_len;
+  }
+  for(i=0;i<e->member_num;i++) {
+    if (IS_CBOR) {
+      head = member_head_cbor[e->member_order[i]];
+    } else {
+      head = member_head[e->member_order[i]];
+      if (i == 0 && ! tagged) head++;
+    }
+    iov[n].iov_base = (void *)head;
+    iov[n++].iov_len = strlen(head);
+    iov[n].iov_base = e->member[e->member_order[i]].buf;
+    iov[n++].iov_len = e->member[e->member_order[i]].len;
+  }
+  iov[n].iov_base = IS_CBOR ? "\xff" : "}";
+  iov[n++].iov_len = 1;
+
+  *len = 0;
+  for(i=0;i<n;i++) *len += iov[i].iov_len;
+  return n;
+}
+
+/* concatenate the pieces of a line into @a jw */
+static void
+iov_concat(JSONWriter *jw, struct iovec *iov, int n, size_t len)
+{
+  int i;
+
+  jw_reset(jw);
+  jw_reserve(jw, len);
+  for(i=0;i<n;i++) jw_write(jw, iov[i].iov_base, iov[i].iov_len);
+}
+
+/* write all of @a iov, resuming after partial writes */
+static boolean
+writev_all(int fd, struct iovec *iov, int n)
+{
+  ssize_t ret;
+
+  while (n > 0) {
+    ret = writev(fd, iov, n);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return FALSE;
+    }
+    while (n > 0 && (size_t)ret >= iov->iov_len) {
+      ret -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * Compressed record stream ("compress=").  Records for the descriptor
+ * are gathered into frames of "compressrecords" records at most, and
+ * a frame is compressed and written when it is full or has been open
+ * for "compressmsec" milliseconds, by a thread watching the clock so
+ * that a quiet stream does not hold records back.  Each frame is a
+ * complete zstd frame or gzip member, so a reader can decode the
+ * stream up to the last frame written, as "zstd -dc" or "zcat" of a
+ * file that is still growing do, and a crash loses the open frame
+ * only.  zstd is used when built in, and gzip otherwise.
+ *
+ * Records are small and alike, so zstd can use a dictionary
+ * ("compressdict=path"): one trained with "zstd --train" on records,
+ * or, if the file does not exist yet, a preset of the keys and values
+ * result_pass2() writes, saved there for readers to decode with.
+ */
+enum { COMPRESS_NONE, COMPRESS_AUTO, COMPRESS_ZSTD, COMPRESS_GZIP };
+
+static struct {
+  int method;			///< COMPRESS_ZSTD or COMPRESS_GZIP when running
+  char *buf;			///< records of the open frame
+  size_t len;
+  size_t size;
+  unsigned long records;	///< records in the open frame
+  long long start;		///< json_clock() at the first of them
+  char *out;			///< compressed frame
+  size_t outsize;
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+  ZSTD_CDict *cdict;		///< dictionary, or NULL
+#endif
+#ifdef HAVE_ZLIB
+  z_stream zs;
+#endif
+  unsigned long long bytes_in;	///< record bytes compressed so far
+  unsigned long long bytes_out;	///< compressed bytes written so far
+  boolean quit;			///< the thread should exit
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+} cstream = { .method = COMPRESS_NONE };
+
+#ifdef HAVE_ZSTD
+/* a record of the schema of result_pass2(), for a preset dictionary */
+static const char cstream_preset[] =
+  "{\"TIME\":{\"LISTEN\":1700000000,\"STARTREC\":1700000000,\"ENDREC\":1700000000},"
+  "\"PASS1\":[{\"ID\":0,\"NAME\":\"_default\",\"STATUS\":\"SUCCESS\",\"succeeded\":true}],"
+  "\"INPUT\":{\"FRAMES\":100,\"MSEC\":1000},"
+  "\"RECOGOUT\":[{\"ID\":0,\"NAME\":\"_default\",\"STATUS\":\"SUCCESS\",\"succeeded\":true,"
+  "\"SHYPO\":[{\"RANK\":1,\"SCORE\":-1000.0,\"AMSCORE\":-1000.0,\"LMSCORE\":-10.0,"
+  "\"WHYPO\":[{\"WORD\":\"\",\"CLASSID\":\"<s>\",\"PHONE\":\"silB\",\"CM\":1,\"BEGINFRAME\":0,\"ENDFRAME\":10},"
+  "{\"WORD\":\"\",\"CLASSID\":\"\",\"PHONE\":\"\",\"CM\":0.5,\"BEGINFRAME\":11,\"ENDFRAME\":20},"
+  "{\"WORD\":\"。\",\"CLASSID\":\"</s>\",\"PHONE\":\"silE\",\"CM\":1,\"BEGINFRAME\":21,\"ENDFRAME\":30}]}]}],"
+  "\"GMM\":{\"RESULT\":\"\",\"CMSCORE\":1},"
+  "\"sentence\":\"\",\"succeeded\":true,"
+  "\"result\":[{\"ID\":0,\"NAME\":\"_default\",\"STATUS\":\"SUCCESS\",\"succeeded\":true}]}\n";
+
+/* load the dictionary at @a path, or save the preset there first */
+static boolean
+cstream_dict(char *path)
+{
+  struct stat st;
+  char *dict;
+  size_t len;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 && errno == ENOENT) {
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return FALSE;
+    len = sizeof(cstream_preset) - 1;
+    if (write(fd, cstream_preset, len) != (ssize_t)len) {
+      close(fd);
+      return FALSE;
+    }
+    close(fd);
+    cstream.cdict = ZSTD_createCDict(cstream_preset, len, json_conf.compress_level);
+    return (cstream.cdict != NULL);
+  }
+  if (fd < 0 || fstat(fd, &st) < 0) return FALSE;
+  dict = (char *)json_malloc(st.st_size + 1);
+  len = read(fd, dict, st.st_size);
+  close(fd);
+  if (len != (size_t)st.st_size) {
+    json_free(dict);
+    return FALSE;
+  }
+  cstream.cdict = ZSTD_createCDict(dict, len, json_conf.compress_level);
+  json_free(dict);
+  return (cstream.cdict != NULL);
+}
+#endif
+
+/* compress the open frame and write it out; called with the mutex held */
+static void
+cstream_frame()
+{
+  struct iovec iov;
+  size_t bound, n;
+
+  if (cstream.records == 0) return;
+  bound = 0;
+#ifdef HAVE_ZSTD
+  if (cstream.method == COMPRESS_ZSTD) bound = ZSTD_compressBound(cstream.len);
+#endif
+#ifdef HAVE_ZLIB
+  if (cstream.method == COMPRESS_GZIP) bound = deflateBound(&(cstream.zs), cstream.len);
+#endif
+  if (cstream.outsize < bound) {
+    cstream.out = (char *)json_realloc(cstream.out, bound);
+    cstream.outsize = bound;
+  }
+  n = 0;
+#ifdef HAVE_ZSTD
+  if (cstream.method == COMPRESS_ZSTD) {
+    if (cstream.cdict != NULL) {
+      n = ZSTD_compress_usingCDict(cstream.cctx, cstream.out, bound, cstream.buf, cstream.len, cstream.cdict);
+    } else {
+      n = ZSTD_compressCCtx(cstream.cctx, cstream.out, bound, cstream.buf, cstream.len, json_conf.compress_level);
+    }
+    if (ZSTD_isError(n)) {
+      jlog("ERROR: json: failed to compress records: %s\n", ZSTD_getErrorName(n));
+      n = 0;
+    }
+  }
+#endif
+#ifdef HAVE_ZLIB
+  if (cstream.method == COMPRESS_GZIP) {
+    /* a gzip member of its own */
+    deflateReset(&(cstream.zs));
+    cstream.zs.next_in = (Bytef *)cstream.buf;
+    cstream.zs.avail_in = cstream.len;
+    cstream.zs.next_out = (Bytef *)cstream.out;
+    cstream.zs.avail_out = bound;
+    if (deflate(&(cstream.zs), Z_FINISH) == Z_STREAM_END) {
+      n = bound - cstream.zs.avail_out;
+    } else {
+      jlog("ERROR: json: failed to compress records\n");
+    }
+  }
+#endif
+  if (n > 0) {
+    iov.iov_base = cstream.out;
+    iov.iov_len = n;
+    if (writev_all(json_conf.fd, &iov, 1) == FALSE) {
+      jlog("ERROR: json: failed to write records: %s\n", strerror(errno));
+    }
+    cstream.bytes_in += cstream.len;
+    cstream.bytes_out += n;
+  }
+  cstream.len = 0;
+  cstream.records = 0;
+}
+
+/* add a record line given as @a iov to the open frame */
+static void
+cstream_write(struct iovec *iov, int n, size_t len)
+{
+  int i;
+
+  pthread_mutex_lock(&(cstream.mutex));
+  if (cstream.len + len > cstream.size) {
+    cstream.size = (cstream.size == 0) ? 65536 : cstream.size;
+    while (cstream.size < cstream.len + len) cstream.size *= 2;
+    cstream.buf = (char *)json_realloc(cstream.buf, cstream.size);
+  }
+  for(i=0;i<n;i++) {
+    memcpy(cstream.buf + cstream.len, iov[i].iov_base, iov[i].iov_len);
+    cstream.len += iov[i].iov_len;
+  }
+  if (cstream.records++ == 0) {
+    cstream.start = json_clock();
+    pthread_cond_signal(&(cstream.cond));
+  }
+  if (cstream.records >= json_conf.compress_records
+      || json_clock() - cstream.start >= json_conf.compress_msec * 1000000LL) {
+    cstream_frame();
+  }
+  pthread_mutex_unlock(&(cstream.mutex));
+}
+
+/* close a frame that has been open for too long */
+static void *
+cstream_main(void *arg)
+{
+  struct timeval now;
+  struct timespec until;
+  long long wait;
+
+  pthread_mutex_lock(&(cstream.mutex));
+  while (! cstream.quit) {
+    if (cstream.records == 0) {
+      pthread_cond_wait(&(cstream.cond), &(cstream.mutex));
+      continue;
+    }
+    wait = cstream.start + json_conf.compress_msec * 1000000LL - json_clock();
+    if (wait <= 0) {
+      cstream_frame();
+      continue;
+    }
+    gettimeofday(&now, NULL);
+    until.tv_sec = now.tv_sec + wait / 1000000000LL;
+    until.tv_nsec = now.tv_usec * 1000 + wait % 1000000000LL;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&(cstream.cond), &(cstream.mutex), &until);
+  }
+  pthread_mutex_unlock(&(cstream.mutex));
+  return NULL;
+}
+
+static boolean
+cstream_start()
+{
+  if (json_conf.compress == COMPRESS_AUTO) {
+#ifdef HAVE_ZSTD
+    json_conf.compress = COMPRESS_ZSTD;
+#else
+    json_conf.compress = COMPRESS_GZIP;
+#endif
+  }
+  if (json_conf.compress_level < 0) json_conf.compress_level = (json_conf.compress == COMPRESS_ZSTD) ? 3 : 6;
+#ifdef HAVE_ZSTD
+  if (json_conf.compress == COMPRESS_ZSTD) {
+    cstream.cctx = ZSTD_createCCtx();
+    if (cstream.cctx == NULL) return FALSE;
+    if (json_conf.compress_dict != NULL && ! cstream_dict(json_conf.compress_dict)) {
+      jlog("ERROR: json: failed to load dictionary %s\n", json_conf.compress_dict);
+      return FALSE;
+    }
+  }
+#endif
+#ifdef HAVE_ZLIB
+  if (json_conf.compress == COMPRESS_GZIP) {
+    if (json_conf.compress_dict != NULL) {
+      jlog("ERROR: json: dictionaries need zstd\n");
+      return FALSE;
+    }
+    /* window bits 15 + 16 for a gzip header and trailer */
+    if (deflateInit2(&(cstream.zs), json_conf.compress_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return FALSE;
+  }
+#endif
+  pthread_mutex_init(&(cstream.mutex), NULL);
+  pthread_cond_init(&(cstream.cond), NULL);
+  if (pthread_create(&(cstream.thread), NULL, cstream_main, NULL) != 0) {
+    jlog("ERROR: json: failed to create compression thread\n");
+    return FALSE;
+  }
+  cstream.method = json_conf.compress;
+  return TRUE;
+}
+
+/* write out the open frame, at exit */
+static void
+cstream_finish()
+{
+  pthread_mutex_lock(&(cstream.mutex));
+  cstream_frame();
+  cstream.quit = TRUE;
+  pthread_cond_signal(&(cstream.cond));
+  pthread_mutex_unlock(&(cstream.mutex));
+  pthread_join(cstream.thread, NULL);
+  if (cstream.bytes_in > 0) {
+    jlog("STAT: JSON: COMPRESSED %llu BYTES TO %llu\n", cstream.bytes_in, cstream.bytes_out);
+  }
+}
+
+/**
+ * Definitions of dictionary words.
+ *
+ * Julius frees and rebuilds the dictionary of a process when a
+ * grammar is added, deleted or swapped, and malloc() often hands back
+ * the same addresses, so neither the WORD_INFO nor the strings of a
+ * word tell whether it is still the same word.  What is kept per word
+ * therefore keeps a copy of what the word was defined by: the wlen
+ * byte, the HMM pointers, which stay as long as the acoustic model,
+ * then woutput and wname.
+ */
+static char *
+word_source_copy(char *src, WORD_INFO *winfo, WORD_ID w)
+{
+  size_t nh, no, nn;
+
+  nh = sizeof(HMM_Logical *) * winfo->wlen[w];
+  no = strlen(winfo->woutput[w]) + 1;
+  nn = strlen(winfo->wname[w]) + 1;
+  src = (char *)json_realloc(src, 1 + nh + no + nn);
+  src[0] = winfo->wlen[w];
+  memcpy(src + 1, winfo->wseq[w], nh);
+  memcpy(src + 1 + nh, winfo->woutput[w], no);
+  memcpy(src + 1 + nh + no, winfo->wname[w], nn);
+  return src;
+}
+
+/* whether word @a w is still defined as in @a src, which may be NULL */
+static boolean
+word_source_same(const char *src, WORD_INFO *winfo, WORD_ID w)
+{
+  size_t nh;
+
+  if (src == NULL || (unsigned char)src[0] != winfo->wlen[w]) return FALSE;
+  nh = sizeof(HMM_Logical *) * winfo->wlen[w];
+  if (memcmp(src + 1, winfo->wseq[w], nh) != 0) return FALSE;
+  src += 1 + nh;
+  if (strcmp(src, winfo->woutput[w]) != 0) return FALSE;
+  src += strlen(src) + 1;
+  return (strcmp(src, winfo->wname[w]) == 0);
+}
+
+/**
+ * Callback trace, given by "trace=path".
+ *
+ * Each engine records what its callbacks are given into a buffer of
+ * its own, in the format of jsontrace.h, and writes it to the trace
+ * at the end of each utterance, so the records of engines are not
+ * mixed within an utterance.  The hooks that record run before the
+ * callbacks that output, and record everything they may read whatever
+ * fields are selected, so that a trace can be replayed with any
+ * options.  Dictionary words and HMMs are recorded once per engine,
+ * when an event first refers to them, and words again when they have
+ * changed since.
+ */
+typedef struct {
+  unsigned char *buf;
+  size_t len;
+  size_t size;
+} TraceBuf;
+
+typedef struct {
+  WORD_INFO *winfo;
+  int num;			///< words recorded in the JSONTRACE_DICT
+  char **src;			///< word_source_copy() of the words defined so far
+} TraceDict;
+
+typedef struct {
+  RecogProcess *r;
+  WORD_INFO *winfo;		///< dictionary recorded for it
+} TraceProcess;
+
+/* data of a hook: the engine and the callback it records */
+typedef struct {
+  struct __json_trace__ *t;
+  int code;
+} TraceHook;
+
+typedef struct __json_trace__ {
+  JSONEngine *e;
+  TraceBuf out;			///< records to write at the end of the utterance
+  TraceBuf ev;			///< payload of the event being recorded
+  TraceBuf def;			///< payload of a definition
+  HMM_Logical **hmm;		///< HMMs recorded, hashed by address
+  int *hmm_id;
+  int hmm_num;
+  int hmm_size;			///< power of two
+  TraceDict *dict;
+  int dict_num;
+  TraceProcess *process;
+  int process_num;
+  TraceHook hook[SIZEOF_CALLBACK_ID];
+} JSONTrace;
+
+static struct {
+  int fd;
+  pthread_mutex_t mutex;	///< for writing
+} trace = { -1, PTHREAD_MUTEX_INITIALIZER };
+
+/* the callbacks of the plugin, to be recorded */
+static const int trace_code[] = {
+  CALLBACK_EVENT_SPEECH_READY, CALLBACK_EVENT_SPEECH_START, CALLBACK_EVENT_SPEECH_STOP,
+  CALLBACK_EVENT_PASS1_BEGIN, CALLBACK_EVENT_PASS1_END, CALLBACK_RESULT_PASS1_INTERIM,
+  CALLBACK_RESULT_PASS1, CALLBACK_STATUS_PARAM, CALLBACK_RESULT, CALLBACK_RESULT_GMM,
+  CALLBACK_RESULT_GRAPH, CALLBACK_RESULT_CONFNET, CALLBACK_EVENT_SEGMENT_END,
+  CALLBACK_EVENT_RECOGNITION_END
+};
+
+/* make room for @a n more bytes */
+static unsigned char *
+trace_grow(TraceBuf *b, size_t n)
+{
+  if (b->len + n > b->size) {
+    b->size = (b->size == 0) ? 4096 : b->size;
+    while (b->size < b->len + n) b->size *= 2;
+    b->buf = (unsigned char *)json_realloc(b->buf, b->size);
+  }
+  return b->buf + b->len;
+}
+
+static void
+trace_uint(TraceBuf *b, unsigned long long v)
+{
+  b->len += jsontrace_put_uint(trace_grow(b, JSONTRACE_VARINT_MAX), v);
+}
+
+static void
+trace_int(TraceBuf *b, long long v)
+{
+  b->len += jsontrace_put_int(trace_grow(b, JSONTRACE_VARINT_MAX), v);
+}
+
+static void
+trace_float(TraceBuf *b, float f)
+{
+  b->len += jsontrace_put_float(trace_grow(b, 4), f);
+}
+
+static void
+trace_string(TraceBuf *b, const char *s)
+{
+  size_t n = strlen(s);
+
+  trace_uint(b, n);
+  memcpy(trace_grow(b, n), s, n);
+  b->len += n;
+}
+
+/* a string that may be NULL */
+static void
+trace_string_opt(TraceBuf *b, const char *s)
+{
+  trace_uint(b, s != NULL);
+  if (s != NULL) trace_string(b, s);
+}
+
+/* append a record of @a tag with the payload in @a p to the output */
+static void
+trace_record(JSONTrace *t, int tag, TraceBuf *p)
+{
+  *trace_grow(&(t->out), 1) = tag;
+  t->out.len++;
+  trace_uint(&(t->out), t->e->id);
+  trace_uint(&(t->out), p->len);
+  memcpy(trace_grow(&(t->out), p->len), p->buf, p->len);
+  t->out.len += p->len;
+  p->len = 0;
+}
+
+/* ID of HMM @a h, defining it first if new */
+static int
+trace_hmm(JSONTrace *t, HMM_Logical *h)
+{
+  HMM_Logical **old;
+  int *old_id;
+  int i, k, old_size;
+
+  if (t->hmm_num * 2 >= t->hmm_size) {
+    old = t->hmm;
+    old_id = t->hmm_id;
+    old_size = t->hmm_size;
+    t->hmm_size = (old_size == 0) ? 1024 : old_size * 2;
+    t->hmm = (HMM_Logical **)json_malloc(sizeof(HMM_Logical *) * t->hmm_size);
+    t->hmm_id = (int *)json_malloc(sizeof(int) * t->hmm_size);
+    memset(t->hmm, 0, sizeof(HMM_Logical *) * t->hmm_size);
+    for(i=0;i<old_size;i++) {
+      if (old[i] == NULL) continue;
+      for(k=((size_t)old[i] >> 4) & (t->hmm_size - 1);t->hmm[k];k=(k + 1) & (t->hmm_size - 1));
+      t->hmm[k] = old[i];
+      t->hmm_id[k] = old_id[i];
+    }
+    if (old != NULL) {
+      json_free(old);
+      json_free(old_id);
+    }
+  }
+  for(k=((size_t)h >> 4) & (t->hmm_size - 1);t->hmm[k];k=(k + 1) & (t->hmm_size - 1)) {
+    if (t->hmm[k] == h) return t->hmm_id[k];
+  }
+  t->hmm[k] = h;
+  t->hmm_id[k] = t->hmm_num++;
+  trace_uint(&(t->def), t->hmm_id[k]);
+  trace_string(&(t->def), h->name);
+  trace_record(t, JSONTRACE_HMM, &(t->def));
+  return t->hmm_id[k];
+}
+
+/* ID of dictionary @a winfo, defining it or its new size first */
+static int
+trace_dict(JSONTrace *t, WORD_INFO *winfo)
+{
+  TraceDict *d;
+  int i;
+
+  for(i=0;i<t->dict_num;i++) {
+    if (t->dict[i].winfo == winfo) break;
+  }
+  if (i == t->dict_num) {
+    t->dict = (TraceDict *)json_realloc(t->dict, sizeof(TraceDict) * (t->dict_num + 1));
+    d = &(t->dict[t->dict_num++]);
+    d->winfo = winfo;
+    d->num = 0;
+    d->src = NULL;
+  }
+  d = &(t->dict[i]);
+  if (d->num < winfo->num) {
+    d->src = (char **)json_realloc(d->src, sizeof(char *) * winfo->num);
+    memset(d->src + d->num, 0, sizeof(char *) * (winfo->num - d->num));
+    d->num = winfo->num;
+    trace_uint(&(t->def), i);
+    trace_uint(&(t->def), d->num);
+    trace_record(t, JSONTRACE_DICT, &(t->def));
+  }
+  return i;
+}
+
+/* define word @a w of dictionary @a dict if not yet, or if it changed */
+static void
+trace_word(JSONTrace *t, int dict, WORD_ID w)
+{
+  TraceDict *d = &(t->dict[dict]);
+  WORD_INFO *winfo = d->winfo;
+  int j;
+
+  if (w >= d->num || word_source_same(d->src[w], winfo, w)) return;
+  d->src[w] = word_source_copy(d->src[w], winfo, w);
+  /* HMMs first, as they are defined through the same buffer */
+  for(j=0;j<winfo->wlen[w];j++) trace_hmm(t, winfo->wseq[w][j]);
+  trace_uint(&(t->def), dict);
+  trace_uint(&(t->def), w);
+  trace_string(&(t->def), winfo->wname[w]);
+  trace_string(&(t->def), winfo->woutput[w]);
+  trace_uint(&(t->def), winfo->wlen[w]);
+  for(j=0;j<winfo->wlen[w];j++) trace_uint(&(t->def), trace_hmm(t, winfo->wseq[w][j]));
+  trace_record(t, JSONTRACE_WORD, &(t->def));
+}
+
+/* index of process @a r, defining it first if new or its dictionary changed */
+static int
+trace_process(JSONTrace *t, RecogProcess *r)
+{
+  TraceProcess *p;
+  int i, dict;
+
+  for(i=0;i<t->process_num;i++) {
+    if (t->process[i].r == r) break;
+  }
+  if (i == t->process_num) {
+    t->process = (TraceProcess *)json_realloc(t->process, sizeof(TraceProcess) * (t->process_num + 1));
+    t->process[t->process_num].r = r;
+    t->process[t->process_num++].winfo = NULL;
+  }
+  p = &(t->process[i]);
+  dict = trace_dict(t, r->lm->winfo);
+  if (p->winfo != r->lm->winfo) {
+    p->winfo = r->lm->winfo;
+    trace_uint(&(t->def), i);
+    trace_int(&(t->def), r->config->id);
+    trace_string(&(t->def), r->config->name);
+    trace_uint(&(t->def), r->lmtype);
+#ifdef USE_MBR
+    trace_uint(&(t->def), r->config->mbr.use_mbr);
+#else
+    trace_uint(&(t->def), 0);
+#endif
+    trace_uint(&(t->def), dict);
+    trace_record(t, JSONTRACE_PROCESS, &(t->def));
+  }
+  return i;
+}
+
+/* words of a sentence, defining them */
+static void
+trace_words(JSONTrace *t, int dict, WORD_ID *seq, int num)
+{
+  int i;
+
+  trace_uint(&(t->ev), num);
+  for(i=0;i<num;i++) {
+    trace_word(t, dict, seq[i]);
+    trace_uint(&(t->ev), seq[i]);
+  }
+}
+
+static void
+trace_sentence(JSONTrace *t, int dict, Sentence *s)
+{
+  SentenceAlign *a;
+  int i, n;
+
+  trace_words(t, dict, s->word, s->word_num);
+  for(i=0;i<s->word_num;i++) {
+#if defined(CONFIDENCE_MEASURE) && ! defined(CM_MULTIPLE_ALPHA)
+    trace_float(&(t->ev), s->confidence[i]);
+#else
+    trace_float(&(t->ev), 0);
+#endif
+  }
+  trace_float(&(t->ev), s->score);
+  trace_float(&(t->ev), s->score_am);
+  trace_float(&(t->ev), s->score_lm);
+  trace_int(&(t->ev), s->gram_id);
+#ifdef USE_MBR
+  trace_float(&(t->ev), s->score_mbr);
+#else
+  trace_float(&(t->ev), 0);
+#endif
+  n = 0;
+  for(a=s->align;a;a=a->next) n++;
+  trace_uint(&(t->ev), n);
+  for(a=s->align;a;a=a->next) {
+    trace_uint(&(t->ev), a->unittype);
+    trace_uint(&(t->ev), a->num);
+    for(i=0;i<a->num;i++) {
+      if (a->unittype != PER_WORD) {
+	trace_uint(&(t->ev), trace_hmm(t, a->ph[i]));
+	trace_int(&(t->ev), a->loc[i]);
+      }
+      trace_int(&(t->ev), a->begin_frame[i]);
+      trace_int(&(t->ev), a->end_frame[i]);
+      if (a->unittype != PER_WORD) trace_float(&(t->ev), a->avgscore[i]);
+    }
+    if (a->unittype != PER_WORD) trace_float(&(t->ev), a->allscore);
+  }
+}
+
+/* the processes of @a recog, with what callback @a code reads of them */
+static void
+trace_processes(JSONTrace *t, Recog *recog, int code)
+{
+  RecogProcess *r;
+  WordGraph *wg;
+  CN_CLUSTER *c;
+  int i, n, dict;
+
+  n = 0;
+  for(r=recog->process_list;r;r=r->next) n++;
+  trace_uint(&(t->ev), n);
+  for(r=recog->process_list;r;r=r->next) {
+    trace_uint(&(t->ev), trace_process(t, r));
+    dict = trace_dict(t, r->lm->winfo);
+    trace_uint(&(t->ev), r->live);
+    trace_uint(&(t->ev), r->have_interim);
+    trace_int(&(t->ev), r->result.status);
+    trace_int(&(t->ev), r->result.num_frame);
+    switch(code) {
+    case CALLBACK_RESULT_PASS1_INTERIM:
+    case CALLBACK_RESULT_PASS1:
+      trace_words(t, dict, r->result.pass1.word, r->result.pass1.word_num);
+      trace_float(&(t->ev), r->result.pass1.score);
+      break;
+    case CALLBACK_RESULT:
+      trace_uint(&(t->ev), r->result.sentnum);
+      for(i=0;i<r->result.sentnum;i++) trace_sentence(t, dict, &(r->result.sent[i]));
+      break;
+    case CALLBACK_RESULT_GRAPH:
+      n = 0;
+      for(wg=r->result.wg;wg;wg=wg->next) n++;
+      trace_uint(&(t->ev), n);
+      for(wg=r->result.wg;wg;wg=wg->next) {
+	trace_word(t, dict, wg->wid);
+	trace_uint(&(t->ev), wg->wid);
+	trace_int(&(t->ev), wg->id);
+	trace_int(&(t->ev), wg->lefttime);
+	trace_int(&(t->ev), wg->righttime);
+	trace_float(&(t->ev), wg->amavg);
+	trace_float(&(t->ev), wg->fscore_head);
+	trace_float(&(t->ev), wg->gscore_tail);
+#ifdef CONFIDENCE_MEASURE
+	trace_float(&(t->ev), wg->graph_cm);
+#else
+	trace_float(&(t->ev), 0);
+#endif
+	trace_uint(&(t->ev), wg->rightwordnum);
+	for(i=0;i<wg->rightwordnum;i++) trace_int(&(t->ev), wg->rightword[i]->id);
+      }
+      break;
+    case CALLBACK_RESULT_CONFNET:
+      n = 0;
+      for(c=r->result.confnet;c;c=c->next) n++;
+      trace_uint(&(t->ev), n);
+      for(c=r->result.confnet;c;c=c->next) {
+	trace_uint(&(t->ev), c->wseqnum);
+	for(i=0;i<c->wseqnum;i++) {
+	  if (c->wseq[i] != WORD_INVALID) trace_word(t, dict, c->wseq[i]);
+	  trace_uint(&(t->ev), c->wseq[i]);
+	}
+	for(i=0;i<c->wseqnum;i++) trace_float(&(t->ev), c->pp[i]);
+      }
+      break;
+    }
+  }
+}
+
+/* write out the records of the utterance */
+static void
+trace_flush(JSONTrace *t)
+{
+  struct iovec iov;
+
+  if (t->out.len == 0) return;
+  iov.iov_base = t->out.buf;
+  iov.iov_len = t->out.len;
+  pthread_mutex_lock(&(trace.mutex));
+  if (writev_all(trace.fd, &iov, 1) == FALSE) {
+    jlog("ERROR: json: failed to write trace: %s\n", strerror(errno));
+  }
+  pthread_mutex_unlock(&(trace.mutex));
+  t->out.len = 0;
+}
+
+/* hook run before the callbacks of the plugin for the same event */
+static void
+trace_callback(Recog *recog, void *data)
+{
+  TraceHook *h = (TraceHook *)data;
+  JSONTrace *t = h->t;
+  MFCCCalc *mfcc;
+  int n;
+
+  trace_uint(&(t->ev), h->code);
+  switch(h->code) {
+  case CALLBACK_STATUS_PARAM:
+    trace_int(&(t->ev), recog->jconf->input.period);
+    trace_int(&(t->ev), recog->jconf->input.frameshift);
+    n = 0;
+    for(mfcc=recog->mfcclist;mfcc;mfcc=mfcc->next) n++;
+    trace_uint(&(t->ev), n);
+    for(mfcc=recog->mfcclist;mfcc;mfcc=mfcc->next) {
+      trace_int(&(t->ev), mfcc->id);
+      trace_int(&(t->ev), mfcc->param->samplenum);
+    }
+    break;
+  case CALLBACK_RESULT_GMM:
+    trace_uint(&(t->ev), recog->gc != NULL);
+    if (recog->gc != NULL) {
+      trace_string(&(t->ev), recog->gc->max_d->name);
+#ifdef CONFIDENCE_MEASURE
+      trace_float(&(t->ev), recog->gc->gmm_max_cm);
+#else
+      trace_float(&(t->ev), 0);
+#endif
+    }
+    break;
+  case CALLBACK_EVENT_RECOGNITION_END:
+    trace_string_opt(&(t->ev), j_get_current_filename(recog));
+    /* fall through */
+  case CALLBACK_RESULT_PASS1_INTERIM:
+  case CALLBACK_RESULT_PASS1:
+  case CALLBACK_RESULT:
+  case CALLBACK_RESULT_GRAPH:
+  case CALLBACK_RESULT_CONFNET:
+    trace_processes(t, recog, h->code);
+    break;
+  }
+  trace_record(t, JSONTRACE_EVENT, &(t->ev));
+  /* the utterance is complete */
+  if (h->code == CALLBACK_EVENT_RECOGNITION_END) trace_flush(t);
+}
+
+/* record the string given to result_best_str() */
+static void
+trace_best(JSONEngine *e, char *str)
+{
+  JSONTrace *t = e->trace;
+
+  trace_string_opt(&(t->ev), str);
+  trace_record(t, JSONTRACE_BEST, &(t->ev));
+}
+
+/* start recording the callbacks of engine @a e, before its own ones */
+static void
+trace_setup(Recog *recog, JSONEngine *e)
+{
+  JSONTrace *t;
+  size_t i;
+
+  t = (JSONTrace *)json_malloc(sizeof(JSONTrace));
+  memset(t, 0, sizeof(JSONTrace));
+  t->e = e;
+  e->trace = t;
+  for(i=0;i<sizeof(trace_code)/sizeof(trace_code[0]);i++) {
+    t->hook[i].t = t;
+    t->hook[i].code = trace_code[i];
+    callback_add(recog, trace_code[i], trace_callback, &(t->hook[i]));
+  }
+  trace_record(t, JSONTRACE_ENGINE, &(t->ev));
+  trace_flush(t);
+}
+
+static boolean
+trace_open()
+{
+  trace.fd = open(json_conf.trace, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (trace.fd < 0) {
+    jlog("ERROR: json: failed to open %s: %s\n", json_conf.trace, strerror(errno));
+    return FALSE;
+  }
+  if (write(trace.fd, JSONTRACE_MAGIC, JSONTRACE_MAGIC_LEN) != JSONTRACE_MAGIC_LEN) {
+    jlog("ERROR: json: failed to write trace: %s\n", strerror(errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* write out what is left of unfinished utterances, at exit */
+static void
+trace_finish()
+{
+  JSONEngine *e;
+
+  for(e=engine_root;e;e=e->next) {
+    if (e->trace != NULL) trace_flush(e->trace);
+  }
+}
+
+/**
+ * Queue between the recognition callbacks and the writer thread.
+ *
+ * A bounded single-producer queue after D. Vyukov: each slot has a
+ * sequence number telling whether it is free for the producer (== pos)
+ * or holds a record for the consumer (== pos + 1).  The decoder thread
+ * only copies the finished record line into a free slot, and the
+ * writer thread does the write() and hands the slot back, so a slow
+ * reader of the records never stalls decoding.  Both sides only sleep
+ * on the condition variable when there is nothing else to do.  The
+ * decoder threads of several engines take turns as the producer
+ * under @a push_mutex, which is never contended with a single engine.
+ *
+ * With the drop-oldest policy the producer also takes records out of
+ * the queue, which is why the head is advanced with compare-and-swap.
+ */
+typedef struct {
+  unsigned long seq;		///< slot state, see above
+  char *buf;			///< record line
+  size_t len;			///< length of the line
+  size_t size;			///< bytes allocated for @a buf
+} RecordSlot;
+
+typedef struct {
+  RecordSlot *slot;
+  int wakefd;			///< wake the consumer through this pipe, or -1
+  unsigned long num;		///< number of slots
+  unsigned long head;		///< next position to take out
+  unsigned long tail;		///< next position to put in (producer only)
+  unsigned long dropped;	///< records lost by overflow
+  int policy;			///< overflow policy
+  int sleeping;			///< number of sides waiting on @a cond
+  int quit;			///< writer thread should exit when empty
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_mutex_t push_mutex;	///< held by the producer
+  pthread_t thread;
+} RecordQueue;
+
+static RecordQueue *record_queue = NULL;
+
+#define ATOMIC_LOAD(P) __atomic_load_n(P, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(P,V) __atomic_store_n(P, V, __ATOMIC_RELEASE)
+#define ATOMIC_CAS(P,E,V) __atomic_compare_exchange_n(P, E, V, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/**
+ * Sleep until the slot sequence @a seq becomes @a value, the queue is
+ * told to quit, or for a while.  The other side wakes us up after it
+ * changed a slot, and as @a seq is checked again under the mutex the
+ * wakeup cannot get lost.
+ */
+static void
+record_queue_wait(RecordQueue *q, unsigned long *seq, unsigned long value)
+{
+  struct timeval now;
+  struct timespec until;
+
+  gettimeofday(&now, NULL);
+  until.tv_sec = now.tv_sec;
+  until.tv_nsec = now.tv_usec * 1000 + 10000000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&(q->mutex));
+  __atomic_add_fetch(&(q->sleeping), 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(seq, __ATOMIC_SEQ_CST) != value && ! ATOMIC_LOAD(&(q->quit))) {
+    pthread_cond_timedwait(&(q->cond), &(q->mutex), &until);
+  }
+  __atomic_sub_fetch(&(q->sleeping), 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&(q->mutex));
+}
+
+static void
+record_queue_wakeup(RecordQueue *q)
+{
+  if (q->wakefd >= 0) {
+    /* a full pipe already has a wakeup pending */
+    while (write(q->wakefd, "", 1) < 0 && errno == EINTR);
+    return;
+  }
+  if (__atomic_load_n(&(q->sleeping), __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&(q->mutex));
+    pthread_cond_broadcast(&(q->cond));
+    pthread_mutex_unlock(&(q->mutex));
+  }
+}
+
+/**
+ * Take out the oldest record and pass it to @a consume, or drop it if
+ * @a consume is NULL.  Returns FALSE if there is none.
+ */
+static boolean
+record_queue_pop(RecordQueue *q, void (*consume)(char *buf, size_t len))
+{
+  RecordSlot *s;
+  unsigned long pos;
+
+  pos = ATOMIC_LOAD(&(q->head));
+  s = &(q->slot[pos % q->num]);
+  if (ATOMIC_LOAD(&(s->seq)) != pos + 1) return FALSE;
+  if (! ATOMIC_CAS(&(q->head), &pos, pos + 1)) return FALSE;
+  if (consume == NULL) {
+    __atomic_add_fetch(&(q->dropped), 1, __ATOMIC_RELAXED);
+  } else {
+    (*consume)(s->buf, s->len);
+  }
+  __atomic_store_n(&(s->seq), pos + q->num, __ATOMIC_SEQ_CST);
+  return TRUE;
+}
+
+static void
+record_write(char *buf, size_t len)
+{
+  struct iovec iov;
+
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  if (cstream.method != COMPRESS_NONE) {
+    cstream_write(&iov, 1, len);
+    return;
+  }
+  if (json_conf.fd == STDOUT_FILENO) fflush(stdout);
+  if (writev_all(json_conf.fd, &iov, 1) == FALSE) {
+    jlog("ERROR: json: failed to write record: %s\n", strerror(errno));
+  }
+}
+
+static void *
+record_queue_writer(void *arg)
+{
+  RecordQueue *q = arg;
+  unsigned long pos;
+
+  for(;;) {
+    if (record_queue_pop(q, record_write)) {
+      record_queue_wakeup(q);
+      continue;
+    }
+    if (ATOMIC_LOAD(&(q->quit))) break;
+    pos = ATOMIC_LOAD(&(q->head));
+    record_queue_wait(q, &(q->slot[pos % q->num].seq), pos + 1);
+  }
+  return NULL;
+}
+
+/**
+ * Put a record line given as @a iov into the queue.  When the queue
+ * is full the record is handled by the overflow policy.
+ */
+static void
+record_queue_push(RecordQueue *q, struct iovec *iov, int n, size_t len)
+{
+  RecordSlot *s;
+  unsigned long pos, old;
+  char *p;
+  int i;
+
+  pthread_mutex_lock(&(q->push_mutex));
+  pos = q->tail;
+  s = &(q->slot[pos % q->num]);
+  while (ATOMIC_LOAD(&(s->seq)) != pos) {
+    /* full: the slot still holds the record num positions before */
+    old = pos - q->num;
+    if (q->policy == OVERFLOW_DROP_OLDEST && ATOMIC_LOAD(&(q->head)) == old) {
+      /* it is still queued; drop it and take its slot */
+      if (record_queue_pop(q, NULL)) continue;
+    }
+    if (q->policy != OVERFLOW_BLOCK) {
+      /* nothing queued to drop, or being written out right now */
+      __atomic_add_fetch(&(q->dropped), 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&(q->push_mutex));
+      return;
+    }
+    record_queue_wait(q, &(s->seq), pos);
+  }
+
+  if (s->size < len) {
+    s->buf = json_realloc(s->buf, len);
+    s->size = len;
+  }
+  p = s->buf;
+  for(i=0;i<n;i++) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+  s->len = len;
+  __atomic_store_n(&(s->seq), pos + 1, __ATOMIC_SEQ_CST);
+  q->tail = pos + 1;
+  pthread_mutex_unlock(&(q->push_mutex));
+  if (q->wakefd >= 0) {
+    /* the consumer empties the queue at each wakeup, so wake it only
+       if it has taken all before this record; pairs with the fence
+       in server_main() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ATOMIC_LOAD(&(q->head)) != pos) return;
+  }
+  record_queue_wakeup(q);
+}
+
+static RecordQueue *
+record_queue_new(int num, int policy)
+{
+  RecordQueue *q;
+  int i;
+
+  q = (RecordQueue *)json_malloc(sizeof(RecordQueue));
+  memset(q, 0, sizeof(RecordQueue));
+  q->slot = (RecordSlot *)json_malloc(sizeof(RecordSlot) * num);
+  memset(q->slot, 0, sizeof(RecordSlot) * num);
+  for(i=0;i<num;i++) q->slot[i].seq = i;
+  q->num = num;
+  q->policy = policy;
+  q->wakefd = -1;
+  pthread_mutex_init(&(q->mutex), NULL);
+  pthread_cond_init(&(q->cond), NULL);
+  pthread_mutex_init(&(q->push_mutex), NULL);
+  return q;
+}
+
+/* start the writer thread of "async" */
+static RecordQueue *
+record_queue_start(int num, int policy)
+{
+  RecordQueue *q;
+
+  q = record_queue_new(num, policy);
+  if (pthread_create(&(q->thread), NULL, record_queue_writer, q) != 0) {
+    jlog("ERROR: json: failed to create writer thread\n");
+    json_free(q->slot);
+    json_free(q);
+    return NULL;
+  }
+  return q;
+}
+
+/* let the writer thread write out what is left, at exit */
+static void
+record_queue_finish()
+{
+  RecordQueue *q = record_queue;
+
+  if (q == NULL) return;
+  __atomic_store_n(&(q->quit), 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&(q->mutex));
+  pthread_cond_broadcast(&(q->cond));
+  pthread_mutex_unlock(&(q->mutex));
+  pthread_join(q->thread, NULL);
+  ATOMIC_STORE(&record_queue, NULL);
+  if (q->dropped > 0) {
+    jlog("STAT: JSON: QUEUE DROPPED=%lu\n", q->dropped);
+  }
+}
+
+#ifdef HAVE_JSON_SERVER
+/**
+ * Record server.
+ *
+ * Clients connected to the Unix domain socket ("unix=path") or to the
+ * TCP port on the loopback address ("tcp=port") receive every record
+ * as a line of JSON without prefix.  The decoder thread only copies a
+ * record into the inbox queue.  The server thread, driven by epoll,
+ * copies it into the send queue of each client and sends as much as
+ * each socket takes.  A client whose send queue has no room for a
+ * record misses that whole record, so a stuck client never blocks
+ * the decoder or the other clients.
+ */
+typedef struct __json_client__ {
+  int fd;
+  char *buf;			///< send queue, a ring of @a size bytes
+  size_t size;
+  size_t head;			///< position of the first byte to send
+  size_t len;			///< bytes queued
+  boolean want_out;		///< waiting for the socket to be writable
+  unsigned long dropped;	///< records missed by this client
+  boolean dead;			///< closed, to be freed by server_reap()
+  struct __json_client__ *next;
+} JSONClient;
+
+#define SERVER_INBOX 64
+
+static struct {
+  int epfd;
+  int listenfd[2];		///< Unix domain and TCP socket
+  int wakefd[2];		///< pipe to wake up the server thread
+  RecordQueue *inbox;		///< records from the decoder thread
+  JSONClient *clients;
+  int quit;
+  pthread_t thread;
+} server = { .epfd = -1, .listenfd = {-1, -1}, .wakefd = {-1, -1} };
+
+static boolean
+set_nonblock(int fd)
+{
+  int flags;
+
+  flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return FALSE;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return TRUE;
+}
+
+static boolean
+server_watch(int fd, int op, unsigned int events, void *ptr)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = ptr;
+  return (epoll_ctl(server.epfd, op, fd, &ev) == 0);
+}
+
+static int
+server_listen(int domain, struct sockaddr *addr, socklen_t addrlen)
+{
+  int fd;
+  int on = 1;
+
+  fd = socket(domain, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (domain == AF_INET) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, addr, addrlen) < 0 || listen(fd, 16) < 0 || ! set_nonblock(fd)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Close the connection of a client.  The client itself stays in the
+ * list, marked dead, as later events of the same epoll_wait() round
+ * may still point to it; server_reap() frees it after the round.
+ */
+static void
+server_close(JSONClient *c)
+{
+  if (c->dead) return;
+  epoll_ctl(server.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if (c->dropped > 0) {
+    jlog("STAT: JSON: client %d closed, %lu records dropped\n", c->fd, c->dropped);
+  }
+  c->fd = -1;
+  c->dead = TRUE;
+}
+
+/* unlink and free the clients closed by server_close() */
+static void
+server_reap()
+{
+  JSONClient **p, *c;
+
+  p = &(server.clients);
+  while ((c = *p) != NULL) {
+    if (! c->dead) {
+      p = &(c->next);
+      continue;
+    }
+    *p = c->next;
+    json_free(c->buf);
+    json_free(c);
+  }
+}
+
+/* send as much of the queue as the socket takes; FALSE on error */
+static boolean
+server_flush(JSONClient *c)
+{
+  ssize_t ret;
+  size_t n;
+
+  while (c->len > 0) {
+    n = c->size - c->head;
+    if (n > c->len) n = c->len;
+    ret = send(c->fd, c->buf + c->head, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return FALSE;
+      if (! c->want_out) {
+	c->want_out = TRUE;
+	server_watch(c->fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT | EPOLLRDHUP, c);
+      }
+      return TRUE;
+    }
+    c->head = (c->head + ret) % c->size;
+    c->len -= ret;
+  }
+  c->head = 0;
+  if (c->want_out) {
+    c->want_out = FALSE;
+    server_watch(c->fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP, c);
+  }
+  return TRUE;
+}
+
+/* queue a record to every client and send it */
+static void
+server_broadcast(char *buf, size_t len)
+{
+  JSONClient *c, *next;
+  size_t tail, n;
+
+  for(c=server.clients;c;c=next) {
+    next = c->next;
+    if (c->dead) continue;
+    if (c->size - c->len < len) {
+      c->dropped++;
+      continue;
+    }
+    tail = (c->head + c->len) % c->size;
+    n = c->size - tail;
+    if (n > len) n = len;
+    memcpy(c->buf + tail, buf, n);
+    memcpy(c->buf, buf + n, len - n);
+    c->len += len;
+    if (! c->want_out && ! server_flush(c)) server_close(c);
+  }
+}
+
+static void
+server_accept(int lfd)
+{
+  JSONClient *c;
+  int fd;
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    if (! set_nonblock(fd)) {
+      close(fd);
+      continue;
+    }
+    c = (JSONClient *)json_malloc(sizeof(JSONClient));
+    memset(c, 0, sizeof(JSONClient));
+    c->fd = fd;
+    c->size = json_conf.clientqueue;
+    c->buf = (char *)json_malloc(c->size);
+    if (! server_watch(fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLRDHUP, c)) {
+      close(fd);
+      json_free(c->buf);
+      json_free(c);
+      continue;
+    }
+    c->next = server.clients;
+    server.clients = c;
+  }
+}
+
+static void *
+server_main(void *arg)
+{
+  struct epoll_event ev[16];
+  JSONClient *c;
+  char buf[256];
+  int i, n;
+
+  while (! ATOMIC_LOAD(&(server.quit))) {
+    n = epoll_wait(server.epfd, ev, 16, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      jlog("ERROR: json: epoll_wait: %s\n", strerror(errno));
+      break;
+    }
+    for(i=0;i<n;i++) {
+      if (ev[i].data.ptr == &(server.wakefd[0])) {
+	while (read(server.wakefd[0], buf, sizeof(buf)) > 0);
+	/* record_queue_push() wakes us only when it finds the queue
+	   empty, so look again after the fence in case it raced */
+	while (record_queue_pop(server.inbox, server_broadcast));
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (record_queue_pop(server.inbox, server_broadcast));
+      } else if (ev[i].data.ptr == &(server.listenfd[0])) {
+	server_accept(server.listenfd[0]);
+      } else if (ev[i].data.ptr == &(server.listenfd[1])) {
+	server_accept(server.listenfd[1]);
+      } else {
+	c = ev[i].data.ptr;
+	/* closed earlier in this round */
+	if (c->dead) continue;
+	if (ev[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+	  server_close(c);
+	  continue;
+	}
+	if (ev[i].events & EPOLLIN) {
+	  /* clients have nothing to say; read and discard */
+	  if (read(c->fd, buf, sizeof(buf)) == 0) {
+	    server_close(c);
+	    continue;
+	  }
+	}
+	if ((ev[i].events & EPOLLOUT) && ! server_flush(c)) server_close(c);
+      }
+    }
+    server_reap();
+  }
+  return NULL;
+}
+
+static void
+server_finish()
+{
+  JSONClient *c;
+
+  if (server.inbox == NULL) return;
+  __atomic_store_n(&(server.quit), 1, __ATOMIC_SEQ_CST);
+  while (write(server.wakefd[1], "", 1) < 0 && errno == EINTR);
+  pthread_join(server.thread, NULL);
+  /* hand the last records to the clients as far as they take them */
+  while (record_queue_pop(server.inbox, server_broadcast));
+  for(c=server.clients;c;c=c->next) server_close(c);
+  server_reap();
+  if (server.listenfd[0] >= 0) {
+    close(server.listenfd[0]);
+    unlink(json_conf.unixpath);
+  }
+  if (server.listenfd[1] >= 0) close(server.listenfd[1]);
+  server.inbox = NULL;
+}
+
+static boolean
+server_start()
+{
+  struct sockaddr_un sun;
+  struct sockaddr_in sin;
+
+  server.epfd = epoll_create(16);
+  if (server.epfd < 0 || pipe(server.wakefd) < 0) {
+    jlog("ERROR: json: failed to set up server: %s\n", strerror(errno));
+    return FALSE;
+  }
+  set_nonblock(server.wakefd[0]);
+  set_nonblock(server.wakefd[1]);
+  server_watch(server.wakefd[0], EPOLL_CTL_ADD, EPOLLIN, &(server.wakefd[0]));
+
+  if (json_conf.unixpath != NULL) {
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(json_conf.unixpath) >= sizeof(sun.sun_path)) {
+      jlog("ERROR: json: socket path too long: %s\n", json_conf.unixpath);
+      return FALSE;
+    }
+    strcpy(sun.sun_path, json_conf.unixpath);
+    unlink(json_conf.unixpath);
+    server.listenfd[0] = server_listen(AF_UNIX, (struct sockaddr *)&sun, sizeof(sun));
+    if (server.listenfd[0] < 0) {
+      jlog("ERROR: json: failed to listen on %s: %s\n", json_conf.unixpath, strerror(errno));
+      return FALSE;
+    }
+    server_watch(server.listenfd[0], EPOLL_CTL_ADD, EPOLLIN, &(server.listenfd[0]));
+  }
+  if (json_conf.tcpport > 0) {
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(json_conf.tcpport);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.listenfd[1] = server_listen(AF_INET, (struct sockaddr *)&sin, sizeof(sin));
+    if (server.listenfd[1] < 0) {
+      jlog("ERROR: json: failed to listen on port %d: %s\n", json_conf.tcpport, strerror(errno));
+      return FALSE;
+    }
+    server_watch(server.listenfd[1], EPOLL_CTL_ADD, EPOLLIN, &(server.listenfd[1]));
+  }
+
+  server.inbox = record_queue_new(SERVER_INBOX, OVERFLOW_DROP_NEWEST);
+  server.inbox->wakefd = server.wakefd[1];
+  if (pthread_create(&(server.thread), NULL, server_main, NULL) != 0) {
+    jlog("ERROR: json: failed to create server thread\n");
+    server.inbox = NULL;
+    return FALSE;
+  }
+  atexit(server_finish);
+  return TRUE;
+}
+#endif /* HAVE_JSON_SERVER */
+
+/**
+ * Shared memory ring ("shm=path").  Records are copied straight into a
+ * file mapped into memory, from where readers on the same host take
+ * them in place.  See jsonring.h for the layout and the reader side.
+ * The ring has a single writer, so engines take turns under @a mutex.
+ */
+static struct {
+  JSONRingHeader *hdr;
+  char *data;
+  uint64_t size;
+  unsigned long toolarge;	///< records that did not fit in the ring
+  pthread_mutex_t mutex;
+} ring = { NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static boolean
+ring_open(char *path, size_t size)
+{
+  JSONRingHeader *hdr;
+  void *map;
+  int fd;
+
+  /* a new file, so that readers of an old ring never see it shrink */
+  unlink(path);
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return FALSE;
+  if (ftruncate(fd, JSONRING_HEADER_SIZE + size) < 0) {
+    close(fd);
+    return FALSE;
+  }
+  map = mmap(NULL, JSONRING_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return FALSE;
+
+  hdr = (JSONRingHeader *)map;
+  hdr->version = JSONRING_VERSION;
+  hdr->header_size = JSONRING_HEADER_SIZE;
+  hdr->size = size;
+  hdr->head = hdr->tail = hdr->seq = 0;
+  JSONRING_STORE(&(hdr->magic), JSONRING_MAGIC);
+
+  ring.hdr = hdr;
+  ring.data = (char *)map + JSONRING_HEADER_SIZE;
+  ring.size = size;
+  return TRUE;
+}
+
+/* move the tail past the frames that will be overwritten up to end */
+static void
+ring_reserve(uint64_t end)
+{
+  JSONRingFrame *f;
+  uint64_t tail;
+
+  tail = ring.hdr->tail;
+  while (tail + ring.size < end) {
+    f = (JSONRingFrame *)(ring.data + (tail & (ring.size - 1)));
+    if (f->len == JSONRING_PAD) {
+      tail += ring.size - (tail & (ring.size - 1));
+    } else {
+      tail += JSONRING_ALIGN(sizeof(JSONRingFrame) + f->len);
+    }
+  }
+  if (tail != ring.hdr->tail) {
+    JSONRING_STORE(&(ring.hdr->tail), tail);
+    /* readers must see the new tail before any overwritten byte */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+}
+
+static void
+ring_write(struct iovec *iov, int n, size_t len)
+{
+  JSONRingFrame *f;
+  uint64_t pos, off, need, seq;
+  char *p;
+  int i;
+
+  need = JSONRING_ALIGN(sizeof(JSONRingFrame) + len);
+  if (need > ring.size / 2) {
+    __atomic_add_fetch(&(ring.toolarge), 1, __ATOMIC_RELAXED);
+    return;
+  }
+  pthread_mutex_lock(&(ring.mutex));
+  pos = ring.hdr->head;
+  seq = ring.hdr->seq;
+  off = pos & (ring.size - 1);
+  if (off + need > ring.size) {
+    /* fill the rest with a padding frame and start over at 0 */
+    ring_reserve(pos + ring.size - off);
+    f = (JSONRingFrame *)(ring.data + off);
+    f->len = JSONRING_PAD;
+    f->seq = seq;
+    pos += ring.size - off;
+    off = 0;
+  }
+  ring_reserve(pos + need);
+  f = (JSONRingFrame *)(ring.data + off);
+  f->len = len;
+  f->seq = seq;
+  p = (char *)(f + 1);
+  for(i=0;i<n;i++) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+  JSONRING_STORE(&(ring.hdr->seq), seq + 1);
+  JSONRING_STORE(&(ring.hdr->head), pos + need);
+  pthread_mutex_unlock(&(ring.mutex));
+}
+
+/**
+ * Batch output ("batch=prefix").  For offline runs over many files,
+ * records are gathered in a buffer of "batchbuffer" bytes and written
+ * with one write() when it is full, into shards named prefix.NNNNN
+ * followed by ".jsonl" or ".cbor".  A shard takes "batchrecords"
+ * records or "batchbytes" bytes at most before the next one is
+ * started, always between records.  Numbers of existing shards are
+ * skipped, so a rerun never overwrites them.  What is buffered goes
+ * out when a shard is closed and at exit, and engines take turns
+ * under @a mutex.
+ */
+static struct {
+  int fd;			///< current shard, or -1
+  int shard;			///< number of the next shard to open
+  char *buf;
+  size_t len;
+  unsigned long records;	///< records in the current shard
+  unsigned long long bytes;	///< bytes in the current shard
+  pthread_mutex_t mutex;
+} batch = { -1, 0, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static void
+batch_flush()
+{
+  struct iovec iov;
+
+  if (batch.len == 0) return;
+  iov.iov_base = batch.buf;
+  iov.iov_len = batch.len;
+  if (writev_all(batch.fd, &iov, 1) == FALSE) {
+    jlog("ERROR: json: failed to write records: %s\n", strerror(errno));
+  }
+  batch.len = 0;
+}
+
+static boolean
+batch_open()
+{
+  char *path;
+
+  path = (char *)json_malloc(strlen(json_conf.batch) + 32);
+  do {
+    sprintf(path, "%s.%05d.%s", json_conf.batch, batch.shard++, IS_CBOR ? "cbor" : "jsonl");
+    batch.fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  } while (batch.fd < 0 && errno == EEXIST);
+  if (batch.fd < 0) {
+    jlog("ERROR: json: failed to open %s: %s\n", path, strerror(errno));
+  } else {
+    jlog("STAT: json: writing records to %s\n", path);
+  }
+  json_free(path);
+  batch.records = 0;
+  batch.bytes = 0;
+  return (batch.fd >= 0);
+}
+
+static void
+batch_close()
+{
+  if (batch.fd < 0) return;
+  batch_flush();
+  close(batch.fd);
+  batch.fd = -1;
+}
+
+static void
+batch_write(struct iovec *iov, int n, size_t len)
+{
+  int i;
+
+  pthread_mutex_lock(&(batch.mutex));
+  if (batch.fd >= 0 && batch.records > 0
+      && ((json_conf.batch_records > 0 && batch.records >= json_conf.batch_records)
+	  || (json_conf.batch_bytes > 0 && batch.bytes + len > json_conf.batch_bytes))) {
+    batch_close();
+  }
+  if (batch.fd < 0 && ! batch_open()) {
+    pthread_mutex_unlock(&(batch.mutex));
+    return;
+  }
+  if (batch.len + len > json_conf.batch_buffer) batch_flush();
+  if (len > json_conf.batch_buffer) {
+    /* larger than the buffer itself */
+    if (writev_all(batch.fd, iov, n) == FALSE) {
+      jlog("ERROR: json: failed to write record: %s\n", strerror(errno));
+    }
+  } else {
+    for(i=0;i<n;i++) {
+      memcpy(batch.buf + batch.len, iov[i].iov_base, iov[i].iov_len);
+      batch.len += iov[i].iov_len;
+    }
+  }
+  batch.records++;
+  batch.bytes += len;
+  pthread_mutex_unlock(&(batch.mutex));
+}
+
+static void
+batch_finish()
+{
+  pthread_mutex_lock(&(batch.mutex));
+  batch_close();
+  pthread_mutex_unlock(&(batch.mutex));
+}
+
+/**
+ * Write out a record given in pieces, and hand it to the server and
+ * the shared memory ring.  A JSON record is terminated by a newline,
+ * and a CBOR one is framed by its length where a stream carries it.
+ *
+ * A line up to PIPE_BUF bytes is copied together and written with a
+ * single write(), so that a reader at the other end of a pipe never
+ * sees it split or interleaved.  A longer line goes out as one
+ * writev() of the pieces without being copied.
+ *
+ * With "async", the line is only copied into the queue here and the
+ * writer thread does the rest.  With "compress", it goes into the
+ * frame being compressed.  Otherwise engines take turns to write
+ * under output_mutex, so that their lines never interleave.
+ */
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+json_output(JSONEngine *e, struct iovec *body, int num, size_t len)
+{
+  struct iovec iov[RECORD_IOV_MAX + 3];
+  struct iovec one;
+  unsigned char frame[4];
+  boolean ret;
+  int n, i;
+
+  /* iov[0] is kept for the prefix, and iov[1] for the frame */
+  n = 2;
+  memcpy(&(iov[n]), body, sizeof(struct iovec) * num);
+  n += num;
+  if (IS_CBOR) {
+    if (ring.hdr != NULL) ring_write(&(iov[2]), n - 2, len);
+    for(i=0;i<4;i++) frame[i] = (len >> (24 - i * 8)) & 0xff;
+    iov[1].iov_base = frame;
+    iov[1].iov_len = 4;
+    len += 4;
+    i = 1;
+  } else {
+    iov[n].iov_base = "\n";
+    iov[n++].iov_len = 1;
+    len++;
+    if (ring.hdr != NULL) ring_write(&(iov[2]), n - 2, len);
+    i = 2;
+  }
+#ifdef HAVE_JSON_SERVER
+  if (server.inbox != NULL) record_queue_push(server.inbox, &(iov[i]), n - i, len);
+#endif
+  if (batch.buf != NULL) batch_write(&(iov[i]), n - i, len);
+  if (json_conf.fd < 0) return;
+  if (json_conf.prefix) {
+    iov[--i].iov_base = "JSON> ";
+    iov[i].iov_len = 6;
+    len += 6;
+  }
+  n -= i;
+  memmove(&(iov[0]), &(iov[i]), sizeof(struct iovec) * n);
+
+  if (record_queue != NULL) {
+    record_queue_push(record_queue, iov, n, len);
+    return;
+  }
+  if (cstream.method != COMPRESS_NONE) {
+    cstream_write(iov, n, len);
+    return;
+  }
+
+  if (len <= PIPE_BUF) iov_concat(&(e->line), iov, n, len);
+  pthread_mutex_lock(&output_mutex);
+  /* let anything Julius has buffered on stdout go first */
+  if (json_conf.fd == STDOUT_FILENO) fflush(stdout);
+  if (len <= PIPE_BUF) {
+    one.iov_base = e->line.buf;
+    one.iov_len = e->line.len;
+    ret = writev_all(json_conf.fd, &one, 1);
+  } else {
+    ret = writev_all(json_conf.fd, iov, n);
+  }
+  pthread_mutex_unlock(&output_mutex);
+  if (ret == FALSE) {
+    jlog("ERROR: json: failed to write record: %s\n", strerror(errno));
+  }
+}
+
+/* write out the record line, and return its length */
+static size_t
+json_record_output(JSONEngine *e)
+{
+  struct iovec iov[RECORD_IOV_MAX];
+  size_t len;
+  int n;
+
+  n = json_record_iov(e, iov, &len);
+  json_output(e, iov, n, len);
+  return len;
+}
+
+#ifdef CHARACTER_CONVERSION
+#define OUTPUT_STACKLEN 512 ///< line length output() needs no heap for
+/**
+ * Print a line converted by "-charconv".  Lines of any length are
+ * printed whole: the stack buffers only serve the usual short ones.
+ */
+static void
+output(char *fmt, ...)
+{
+  char inbuf[OUTPUT_STACKLEN];
+  char outbuf[OUTPUT_STACKLEN * 4];
+  char *in = inbuf, *out = outbuf;
+  va_list ap;
+  int ret;
+
+  va_start(ap,fmt);
+  ret = vsnprintf(inbuf, OUTPUT_STACKLEN, fmt, ap);
+  va_end(ap);
+  if (ret <= 0) return;
+  if (ret >= OUTPUT_STACKLEN) {
+    in = (char *)json_malloc(ret + 1);
+    out = (char *)json_malloc(ret * 4 + 1);
+    va_start(ap,fmt);
+    vsnprintf(in, ret + 1, fmt, ap);
+    va_end(ap);
+  }
+  /* a byte grows to 4 bytes at most in any code charconv gives */
+  printf("%s", charconv(in, out, ret * 4 + 1));
+  fflush(stdout);
+  if (in != inbuf) {
+    json_free(in);
+    json_free(out);
+  }
+}
+#else
+#define output printf
+#endif
+
+static void
+nop(void)
+{
+  fflush(stdout);
+}
+
+/* return the value if @a arg is "name=value" */
+static char *
+opt_value(char *arg, const char *name)
+{
+  size_t len = strlen(name);
+
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') return arg + len + 1;
+  return NULL;
+}
+
+/* parse a comma separated list of field names into bits of FIELD() */
+static boolean
+opt_fields(char *list, unsigned long *fields)
+{
+  char *name, *next;
+  int i;
+
+  *fields = 0;
+  for(name=list;name;name=next) {
+    next = strchr(name, ',');
+    if (next != NULL) *next++ = '\0';
+    if (*name == '\0') continue;
+    for(i=0;field_name[i].name;i++) {
+      if (strmatch(name, field_name[i].name)) break;
+    }
+    if (field_name[i].name == NULL) {
+      jlog("ERROR: json: unknown field: %s\n", name);
+      return FALSE;
+    }
+    *fields |= field_name[i].fields;
+  }
+  return TRUE;
+}
+
+static boolean
+opt_json(Jconf *jconf, char *arg[], int argnum)
+{
+  int i, j;
+  size_t size;
+  char *val, *p;
+
+  outout_json_flag = 1;
+  for(i=0;i<argnum;i++) {
+    if (strmatch(arg[i], "fd=none")) {
+      json_conf.fd = -1;
+    } else if ((val = opt_value(arg[i], "fd")) != NULL) {
+      json_conf.fd = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.fd < 0) {
+	jlog("ERROR: json: invalid descriptor: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "file")) != NULL) {
+      json_conf.filename = strdup(val);
+    } else if ((val = opt_value(arg[i], "async")) != NULL) {
+      json_conf.async = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.async < 2) {
+	jlog("ERROR: json: queue needs at least 2 slots: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "overflow")) != NULL) {
+      for(j=0;j<3;j++) {
+	if (strmatch(val, overflow_name[j])) break;
+      }
+      if (j == 3) {
+	jlog("ERROR: json: unknown overflow policy: %s\n", val);
+	return FALSE;
+      }
+      json_conf.overflow = j;
+    } else if (strmatch(arg[i], "interim")) {
+      json_conf.interim = TRUE;
+    } else if ((val = opt_value(arg[i], "interim")) != NULL) {
+      json_conf.interim = TRUE;
+      json_conf.interim_msec = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.interim_msec < 0) {
+	jlog("ERROR: json: invalid interval: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "interimframes")) != NULL) {
+      json_conf.interim = TRUE;
+      json_conf.interim_frames = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.interim_frames < 0) {
+	jlog("ERROR: json: invalid interval: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "unix")) != NULL) {
+      json_conf.unixpath = strdup(val);
+    } else if ((val = opt_value(arg[i], "tcp")) != NULL) {
+      json_conf.tcpport = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.tcpport <= 0 || json_conf.tcpport > 65535) {
+	jlog("ERROR: json: invalid port: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "clientqueue")) != NULL) {
+      json_conf.clientqueue = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.clientqueue <= 0) {
+	jlog("ERROR: json: invalid queue size: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "shm")) != NULL) {
+      json_conf.shmpath = strdup(val);
+    } else if ((val = opt_value(arg[i], "shmsize")) != NULL) {
+      json_conf.shmsize = strtoul(val, &p, 10);
+      if (*val < '0' || *val > '9' || *p != '\0' || json_conf.shmsize > (1UL << 30)) {
+	jlog("ERROR: json: invalid ring size: %s\n", arg[i]);
+	return FALSE;
+      }
+      /* round up to a power of two, 64KB at least */
+      for(size=65536;size<json_conf.shmsize;size<<=1);
+      json_conf.shmsize = size;
+    } else if ((val = opt_value(arg[i], "fields")) != NULL
+	       || (val = opt_value(arg[i], "profile")) != NULL) {
+      p = strdup(val);
+      if (! opt_fields(p, &(json_conf.fields))) {
+	free(p);
+	return FALSE;
+      }
+      free(p);
+    } else if ((val = opt_value(arg[i], "metrics")) != NULL) {
+      json_conf.metrics = strdup(val);
+    } else if ((val = opt_value(arg[i], "metricsinterval")) != NULL) {
+      json_conf.metrics_interval = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.metrics_interval < 0) {
+	jlog("ERROR: json: invalid interval: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "format")) != NULL) {
+      if (strmatch(val, "json")) {
+	json_conf.format = FORMAT_JSON;
+      } else if (strmatch(val, "cbor")) {
+	json_conf.format = FORMAT_CBOR;
+      } else {
+	jlog("ERROR: json: unknown format: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "floats")) != NULL) {
+      if (strmatch(val, "full")) {
+	json_conf.floats = FLOATS_FULL;
+      } else if (strmatch(val, "shortest")) {
+	json_conf.floats = FLOATS_SHORTEST;
+      } else {
+	jlog("ERROR: json: unknown float format: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "cmdigits")) != NULL
+	       || (val = opt_value(arg[i], "scoredigits")) != NULL) {
+      j = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || j < 0 || j > 9) {
+	jlog("ERROR: json: decimal places must be 0 to 9: %s\n", arg[i]);
+	return FALSE;
+      }
+      if (arg[i][0] == 'c') json_conf.cmdigits = j;
+      else json_conf.scoredigits = j;
+    } else if (strmatch(arg[i], "slash")) {
+      json_conf.slash = TRUE;
+    } else if (strmatch(arg[i], "noslash")) {
+      json_conf.slash = FALSE;
+    } else if ((val = opt_value(arg[i], "nbest")) != NULL) {
+      if (strmatch(val, "full")) {
+	json_conf.nbest_compact = FALSE;
+      } else if (strmatch(val, "compact")) {
+	json_conf.nbest_compact = TRUE;
+      } else {
+	jlog("ERROR: json: unknown N-best layout: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "charset")) != NULL) {
+#ifdef CHARACTER_CONVERSION
+      iconv_t cd = iconv_open("UTF-8", val);
+      if (cd == (iconv_t)-1) {
+	jlog("ERROR: json: cannot convert from %s to UTF-8\n", val);
+	return FALSE;
+      }
+      iconv_close(cd);
+      json_conf.charset = strdup(val);
+#else
+      jlog("ERROR: json: charset is not supported without CHARACTER_CONVERSION\n");
+      return FALSE;
+#endif
+    } else if ((val = opt_value(arg[i], "batch")) != NULL) {
+      json_conf.batch = strdup(val);
+    } else if ((val = opt_value(arg[i], "batchrecords")) != NULL) {
+      json_conf.batch_records = strtoul(val, &p, 10);
+      if (*val < '0' || *val > '9' || *p != '\0') {
+	jlog("ERROR: json: invalid number of records: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "batchbytes")) != NULL) {
+      json_conf.batch_bytes = strtoull(val, &p, 10);
+      if (*val < '0' || *val > '9' || *p != '\0') {
+	jlog("ERROR: json: invalid shard size: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "batchbuffer")) != NULL) {
+      json_conf.batch_buffer = strtoul(val, &p, 10);
+      if (*val < '0' || *val > '9' || *p != '\0' || json_conf.batch_buffer < 4096 || json_conf.batch_buffer > (1UL << 30)) {
+	jlog("ERROR: json: invalid buffer size: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if (strmatch(arg[i], "compress")
+	       || (val = opt_value(arg[i], "compress")) != NULL) {
+      if (strmatch(arg[i], "compress") || strmatch(val, "auto")) {
+	json_conf.compress = COMPRESS_AUTO;
+      } else if (strmatch(val, "zstd")) {
+	json_conf.compress = COMPRESS_ZSTD;
+      } else if (strmatch(val, "gzip")) {
+	json_conf.compress = COMPRESS_GZIP;
+      } else {
+	jlog("ERROR: json: unknown compression: %s\n", arg[i]);
+	return FALSE;
+      }
+#ifndef HAVE_ZSTD
+      if (json_conf.compress == COMPRESS_ZSTD) {
+	jlog("ERROR: json: zstd is not built in: %s\n", arg[i]);
+	return FALSE;
+      }
+#endif
+#ifndef HAVE_ZLIB
+      if (json_conf.compress == COMPRESS_GZIP) {
+	jlog("ERROR: json: zlib is not built in: %s\n", arg[i]);
+	return FALSE;
+      }
+#endif
+#if !defined(HAVE_ZSTD) && !defined(HAVE_ZLIB)
+      jlog("ERROR: json: no compression is built in: %s\n", arg[i]);
+      return FALSE;
+#endif
+    } else if ((val = opt_value(arg[i], "compresslevel")) != NULL) {
+      json_conf.compress_level = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.compress_level < 0 || json_conf.compress_level > 19) {
+	jlog("ERROR: json: compression level must be 0 to 19: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "compressrecords")) != NULL) {
+      json_conf.compress_records = strtoul(val, &p, 10);
+      if (*val < '0' || *val > '9' || *p != '\0' || json_conf.compress_records == 0) {
+	jlog("ERROR: json: invalid number of records: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "compressmsec")) != NULL) {
+      json_conf.compress_msec = strtol(val, &p, 10);
+      if (*val == '\0' || *p != '\0' || json_conf.compress_msec < 0) {
+	jlog("ERROR: json: invalid interval: %s\n", arg[i]);
+	return FALSE;
+      }
+    } else if ((val = opt_value(arg[i], "compressdict")) != NULL) {
+      json_conf.compress_dict = strdup(val);
+    } else if ((val = opt_value(arg[i], "trace")) != NULL) {
+      json_conf.trace = strdup(val);
+    } else if (strmatch(arg[i], "prefix")) {
+      json_conf.prefix = 1;
+    } else if (strmatch(arg[i], "noprefix")) {
+      json_conf.prefix = 0;
+    } else {
+      jlog("ERROR: json: unknown argument: %s\n", arg[i]);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+int
+initialize()
+{
+  f2s_init();
+  escape_init();
+  j_add_option("-json", 16, 0, "enable json extension: [fd=N|none] [file=path] [format=json|cbor] [floats=full|shortest] [cmdigits=N] [scoredigits=N] [slash|noslash] [nbest=full|compact] [charset=code] [batch=prefix] [batchrecords=N] [batchbytes=bytes] [batchbuffer=bytes] [compress[=zstd|gzip]] [compresslevel=N] [compressrecords=N] [compressmsec=msec] [compressdict=path] [trace=path] [fields=name,...] [profile=full|standard|minimal] [prefix|noprefix] [async=slots] [overflow=block|drop-oldest|drop-newest] [interim[=msec]] [interimframes=N] [unix=path] [tcp=port] [clientqueue=bytes] [shm=path] [shmsize=bytes] [metrics=file|unix:path] [metricsinterval=sec]", opt_json);
+  return 0;
+}
+
+int
+get_plugin_info(int opcode, char *buf, int buflen)
+{
+  switch(opcode) {
+  case 0:
+    strncpy(buf, "output result with json format", buflen);
+    break;
+  }
+  return 0;
+}
+
+/**
+ * The best sentence, given by Julius without its engine.  It is called
+ * on the thread of the engine after its result callbacks, so it goes
+ * to the engine whose callbacks ran last on this thread, as recorded
+ * by engine_enter().  An application calling it on a thread where no
+ * callback of the plugin has run gets it to the only engine, and
+ * dropped when there are several, since which one it belongs to is
+ * unknown.
+ */
+void
+result_best_str(char *result_str)
+{
+  JSONEngine *e = engine_current;
+  JSONWriter *jw;
+  long long t0 = json_clock();
+
+  if (e == NULL && __atomic_load_n(&engine_num, __ATOMIC_ACQUIRE) == 1) e = __atomic_load_n(&engine_root, __ATOMIC_ACQUIRE);
+  if (e == NULL) return;
+  if (e->trace != NULL) trace_best(e, result_str);
+  if (FIELD_ON(FIELD_SENTENCE)) {
+    jw = member_begin(e, MEMBER_SENTENCE);
+    jw_string(jw, (result_str == NULL) ? "" : charconv_utf8(&(e->conv), result_str));
+  }
+  if (FIELD_ON(FIELD_SUCCEEDED)) {
+    jw = member_begin(e, MEMBER_SUCCEEDED);
+    jw_boolean(jw, result_str != NULL);
+  }
+  json_stamp_build(e, t0);
+}
+
+/**
+ * Subroutine to output information of a recognition status.
+ */
+static const char *get_status_info(int status)
+{
+  const char *info = NULL;
+  switch(status) {
+  case J_RESULT_STATUS_SUCCESS:
+    info = "SUCCESS";
+    break;
+  case J_RESULT_STATUS_REJECT_POWER:
+    info = "REJECTED: by power";
+    break;
+  case J_RESULT_STATUS_TERMINATE:
+    info = "input terminated by request";
+    break;
+  case J_RESULT_STATUS_ONLY_SILENCE:
+    info = "REJECTED: result has pause words only";
+    break;
+  case J_RESULT_STATUS_REJECT_GMM:
+    info = "REJECTED: by GMM";
+    break;
+  case J_RESULT_STATUS_REJECT_SHORT:
+    info = "REJECTED: too short input";
+    break;
+  case J_RESULT_STATUS_REJECT_LONG:
+    info = "REJECTED: too long input";
+    break;
+  case J_RESULT_STATUS_BUFFER_OVERFLOW:
+    info = "REJECTED: buffer overflow";
+    break;
+  case J_RESULT_STATUS_FAIL:
+    info = "RECOGFAIL";
+    break;
+  default:
+    info = "UNKNOWN";
+  }
+  return info;
+}
+
+/**
+ * Subroutine to output the status members common to the per-process
+ * entries of "PASS1", "RECOGOUT" and "result".
+ */
+static void
+process_status_out(RecogProcess *r, JSONWriter *jw)
+{
+  jw_key_integer(jw, "ID", r->config->id);
+  jw_key_string(jw, "NAME", r->config->name);
+  jw_key_string(jw, "STATUS", get_status_info(r->result.status));
+  jw_key_boolean(jw, "succeeded", r->result.status >= 0);
+}
+
+/**
+ * Metrics.
+ *
+ * Records are counted per process and status, together with log2
+ * histograms of the latency of their stages.  Each engine sets up the
+ * tables of its processes at startup, and updates them with relaxed
+ * atomic adds from the callbacks, so counting needs neither locks nor
+ * allocation.  They are exposed
+ * in the Prometheus text format by a thread that rewrites a file or
+ * answers on a Unix domain socket, and summarized by a STAT line at
+ * each interval.
+ */
+#define METRIC_BUCKETS 32	///< upper bounds 2^10 .. 2^41 ns, then +Inf
+#define METRIC_STATUS 10	///< status -8 .. 0, and anything else
+
+enum { METRIC_EMIT, METRIC_PASS1, METRIC_PASS2, METRIC_BUILD, METRIC_STAGE_NUM };
+static const char *metric_stage_name[METRIC_STAGE_NUM] = { "emit", "pass1", "pass2", "build" };
+
+typedef struct {
+  unsigned long bucket[METRIC_BUCKETS + 1];
+  unsigned long count;
+  unsigned long long sum;	///< nanoseconds
+} MetricHist;
+
+typedef struct __metric_process__ {
+  RecogProcess *r;
+  unsigned long records[METRIC_STATUS];
+  MetricHist hist[METRIC_STATUS][METRIC_STAGE_NUM];
+} MetricProcess;
+
+static struct {
+  boolean enabled;
+  unsigned long records;	///< records output
+  unsigned long long bytes;	///< bytes of them
+  unsigned long long input_msec; ///< length of the inputs
+  unsigned long long busy_ns;	///< from the 1st pass to the output
+  unsigned long long arena_bytes; ///< carved from the arenas
+  unsigned long arena_allocs;	///< regions carved from them
+  unsigned long arena_mallocs;	///< chunks the arenas took from the heap
+  size_t arena_peak;		///< most bytes carved in one utterance
+  MetricHist emit;		///< all processes, for the summary
+  MetricHist emit_last;		///< copy at the last summary
+  unsigned long records_last;
+  unsigned long allocs_last;	///< heap.allocs at the last summary
+  long long summary_time;
+  pthread_mutex_t summary_mutex; ///< held by the engine logging the summary
+  int listenfd;
+  boolean quit;			///< the file writer should exit
+  pthread_mutex_t mutex;	///< held by the file writer while awake
+  pthread_cond_t cond;
+  pthread_t thread;
+} metrics = { .enabled = FALSE };
+
+#define METRIC_ADD(P,V) __atomic_fetch_add(P, V, __ATOMIC_RELAXED)
+#define METRIC_LOAD(P) __atomic_load_n(P, __ATOMIC_RELAXED)
+
+static int
+metric_status(int status)
+{
+  if (status > 0 || status < 1 - METRIC_STATUS) return METRIC_STATUS - 1;
+  return -status;
+}
+
+/* label of a slot: the status of its code, or OTHER for the last */
+static const char *
+metric_status_label(int slot)
+{
+  return (slot == METRIC_STATUS - 1) ? "OTHER" : get_status_info(-slot);
+}
+
+static void
+metric_hist_add(MetricHist *h, long long ns)
+{
+  int k;
+
+  if (ns < 0) ns = 0;
+  /* the smallest k with ns <= 2^(10+k) */
+  k = (ns <= 1) ? 0 : 64 - __builtin_clzll((unsigned long long)ns - 1);
+  k -= 10;
+  if (k < 0) k = 0;
+  if (k > METRIC_BUCKETS) k = METRIC_BUCKETS;
+  METRIC_ADD(&(h->bucket[k]), 1);
+  METRIC_ADD(&(h->count), 1);
+  METRIC_ADD(&(h->sum), (unsigned long long)ns);
+}
+
+/* set up the tables of the processes of an engine */
+static void
+metrics_setup(JSONEngine *e)
+{
+  RecogProcess *r;
+  int i;
+
+  for(i=0,r=e->recog->process_list;r;r=r->next) i++;
+  e->metric = (MetricProcess *)json_malloc(sizeof(MetricProcess) * (i > 0 ? i : 1));
+  memset(e->metric, 0, sizeof(MetricProcess) * (i > 0 ? i : 1));
+  for(i=0,r=e->recog->process_list;r;r=r->next) e->metric[i++].r = r;
+  e->metric_num = i;
+}
+
+/* count the record of this utterance, after its stamps are all set */
+static void
+metrics_count(JSONEngine *e, size_t len)
+{
+  MetricProcess *m;
+  RecogProcess *r;
+  long long *stamp = e->stamp;
+  long long span[METRIC_STAGE_NUM];
+  size_t peak, bytes;
+  int i, j, st;
+
+  span[METRIC_EMIT] = (stamp[STAMP_STOP] != 0) ? stamp[STAMP_EMIT] - stamp[STAMP_STOP] : -1;
+  span[METRIC_PASS1] = (stamp[STAMP_PASS1_BEGIN] != 0 && stamp[STAMP_PASS1_END] != 0) ? stamp[STAMP_PASS1_END] - stamp[STAMP_PASS1_BEGIN] : -1;
+  span[METRIC_PASS2] = (stamp[STAMP_PASS1_END] != 0 && stamp[STAMP_RESULT] != 0) ? stamp[STAMP_RESULT] - stamp[STAMP_PASS1_END] : -1;
+  span[METRIC_BUILD] = e->stamp_build;
+
+  METRIC_ADD(&(metrics.records), 1);
+  METRIC_ADD(&(metrics.bytes), len);
+  if (e->stamp_msec > 0 && stamp[STAMP_PASS1_BEGIN] != 0) {
+    METRIC_ADD(&(metrics.input_msec), e->stamp_msec);
+    METRIC_ADD(&(metrics.busy_ns), stamp[STAMP_EMIT] - stamp[STAMP_PASS1_BEGIN]);
+  }
+  if (span[METRIC_EMIT] >= 0) metric_hist_add(&(metrics.emit), span[METRIC_EMIT]);
+  METRIC_ADD(&(metrics.arena_bytes), e->arena.bytes);
+  METRIC_ADD(&(metrics.arena_allocs), e->arena.allocs);
+  METRIC_ADD(&(metrics.arena_mallocs), e->arena.mallocs);
+  /* the arena is reset after this, which updates its own peak */
+  bytes = (e->arena.bytes > e->arena.peak) ? e->arena.bytes : e->arena.peak;
+  peak = METRIC_LOAD(&(metrics.arena_peak));
+  while (bytes > peak && ! __atomic_compare_exchange_n(&(metrics.arena_peak), &peak, bytes, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  for(r=e->recog->process_list;r;r=r->next) {
+    if (! r->live) continue;
+    for(i=0;i<e->metric_num;i++) if (e->metric[i].r == r) break;
+    if (i == e->metric_num) continue; /* created after startup */
+    m = &(e->metric[i]);
+    st = metric_status(r->result.status);
+    METRIC_ADD(&(m->records[st]), 1);
+    for(j=0;j<METRIC_STAGE_NUM;j++) {
+      if (span[j] >= 0) metric_hist_add(&(m->hist[st][j]), span[j]);
+    }
+  }
+}
+
+/* upper bound in msec of the bucket where quantile @a q of @a h falls */
+static double
+metric_quantile(unsigned long *bucket, unsigned long count, double q)
+{
+  unsigned long n = 0;
+  int k;
+
+  for(k=0;k<METRIC_BUCKETS;k++) {
+    n += bucket[k];
+    if (n >= q * count) break;
+  }
+  return (double)(1LL << (10 + k)) / 1000000.0;
+}
+
+/**
+ * Log a summary of the records since the last one, when the interval
+ * has passed.  Runs on the recognition thread that counts them; when
+ * another engine is logging one right now, it is left to that one.
+ */
+static void
+metrics_summary()
+{
+  unsigned long bucket[METRIC_BUCKETS + 1];
+  unsigned long count, success, records, allocs;
+  unsigned long long input_msec, busy_ns;
+  JSONEngine *e;
+  long long now;
+  int i, k;
+
+  now = json_clock();
+  if (now - METRIC_LOAD(&(metrics.summary_time)) < json_conf.metrics_interval * 1000000000LL) return;
+  if (pthread_mutex_trylock(&(metrics.summary_mutex)) != 0) return;
+  if (now - metrics.summary_time < json_conf.metrics_interval * 1000000000LL) {
+    /* another engine has just logged one */
+    pthread_mutex_unlock(&(metrics.summary_mutex));
+    return;
+  }
+  count = 0;
+  for(k=0;k<=METRIC_BUCKETS;k++) {
+    bucket[k] = METRIC_LOAD(&(metrics.emit.bucket[k]));
+    count += bucket[k] - metrics.emit_last.bucket[k];
+  }
+  success = 0;
+  for(e=ATOMIC_LOAD(&engine_root);e;e=e->next) {
+    for(i=0;i<e->metric_num;i++) success += METRIC_LOAD(&(e->metric[i].records[0]));
+  }
+  records = METRIC_LOAD(&(metrics.records));
+  input_msec = METRIC_LOAD(&(metrics.input_msec));
+  busy_ns = METRIC_LOAD(&(metrics.busy_ns));
+  allocs = HEAP_LOAD(&(heap.allocs));
+  for(k=0;k<=METRIC_BUCKETS;k++) {
+    bucket[k] -= metrics.emit_last.bucket[k];
+    metrics.emit_last.bucket[k] += bucket[k];
+  }
+  jlog("STAT: JSON: METRICS RECORDS=%lu (+%lu) SUCCESS=%lu RTF=%.3f EMIT_P50=%.3fms EMIT_P99=%.3fms HEAP=%lu PEAK=%lu ALLOCS=%lu FREES=%lu ALLOCS_PER_UTT=%.3f\n",
+       records, records - metrics.records_last, success,
+       (input_msec > 0) ? busy_ns / (input_msec * 1000000.0) : 0.0,
+       (count > 0) ? metric_quantile(bucket, count, 0.5) : 0.0,
+       (count > 0) ? metric_quantile(bucket, count, 0.99) : 0.0,
+       (unsigned long)HEAP_LOAD(&(heap.bytes)), (unsigned long)HEAP_LOAD(&(heap.peak)),
+       allocs, HEAP_LOAD(&(heap.frees)),
+       (records > metrics.records_last) ? (double)(allocs - metrics.allocs_last) / (records - metrics.records_last) : 0.0);
+  metrics.records_last = records;
+  metrics.allocs_last = allocs;
+  __atomic_store_n(&(metrics.summary_time), now, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&(metrics.summary_mutex));
+}
+
+/* append formatted text to @a w */
+static void
+jw_printf(JSONWriter *w, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  for(;;) {
+    jw_reserve(w, 256);
+    va_start(ap, fmt);
+    n = vsnprintf(w->buf + w->len, w->size - w->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < w->size - w->len) break;
+    jw_reserve(w, n + 1);
+  }
+  w->len += n;
+}
+
+/* put the labels of an engine, process and status */
+static void
+metric_labels(JSONWriter *w, JSONEngine *e, RecogProcess *r, int st)
+{
+  const char *p;
+
+  jw_printf(w, "{engine=\"%d\",id=\"%d\",name=\"", e->id, r->config->id);
+  for(p=r->config->name;*p;p++) {
+    if (*p == '"' || *p == '\\') jw_write(w, "\\", 1);
+    if (*p == '\n') jw_write(w, "\\n", 2);
+    else jw_write(w, p, 1);
+  }
+  jw_printf(w, "\",status=\"%s\"", metric_status_label(st));
+}
+
+/* format all metrics in the Prometheus text format into @a w */
+static void
+metrics_format(JSONWriter *w)
+{
+  RecordQueue *q;
+  JSONEngine *e;
+  MetricProcess *m;
+  MetricHist *h;
+  unsigned long n;
+  int i, st, j, k;
+
+  jw_reset(w);
+  jw_printf(w, "# HELP julius_json_records_total Records output.\n# TYPE julius_json_records_total counter\njulius_json_records_total %lu\n", METRIC_LOAD(&(metrics.records)));
+  jw_printf(w, "# HELP julius_json_record_bytes_total Bytes of records output.\n# TYPE julius_json_record_bytes_total counter\njulius_json_record_bytes_total %llu\n", METRIC_LOAD(&(metrics.bytes)));
+  jw_printf(w, "# HELP julius_json_input_seconds_total Length of recognized inputs.\n# TYPE julius_json_input_seconds_total counter\njulius_json_input_seconds_total %.3f\n", METRIC_LOAD(&(metrics.input_msec)) / 1000.0);
+  jw_printf(w, "# HELP julius_json_busy_seconds_total Time from the 1st pass to the output of records.\n# TYPE julius_json_busy_seconds_total counter\njulius_json_busy_seconds_total %.9f\n", METRIC_LOAD(&(metrics.busy_ns)) / 1e9);
+  jw_printf(w, "# HELP julius_json_arena_bytes_total Bytes carved from the per-utterance arenas.\n# TYPE julius_json_arena_bytes_total counter\njulius_json_arena_bytes_total %llu\n", METRIC_LOAD(&(metrics.arena_bytes)));
+  jw_printf(w, "# HELP julius_json_arena_allocs_total Regions carved from the arenas, a few per record.\n# TYPE julius_json_arena_allocs_total counter\njulius_json_arena_allocs_total %lu\n", METRIC_LOAD(&(metrics.arena_allocs)));
+  jw_printf(w, "# HELP julius_json_arena_peak_bytes Most bytes carved from an arena in one utterance.\n# TYPE julius_json_arena_peak_bytes gauge\njulius_json_arena_peak_bytes %lu\n", (unsigned long)METRIC_LOAD(&(metrics.arena_peak)));
+  jw_printf(w, "# HELP julius_json_arena_mallocs_total Chunks the arenas took from the heap.\n# TYPE julius_json_arena_mallocs_total counter\njulius_json_arena_mallocs_total %lu\n", METRIC_LOAD(&(metrics.arena_mallocs)));
+  jw_printf(w, "# HELP julius_json_heap_bytes Bytes of memory the plugin has allocated.\n# TYPE julius_json_heap_bytes gauge\njulius_json_heap_bytes %lu\n", (unsigned long)HEAP_LOAD(&(heap.bytes)));
+  jw_printf(w, "# HELP julius_json_heap_peak_bytes High-water mark of julius_json_heap_bytes.\n# TYPE julius_json_heap_peak_bytes gauge\njulius_json_heap_peak_bytes %lu\n", (unsigned long)HEAP_LOAD(&(heap.peak)));
+  jw_printf(w, "# HELP julius_json_heap_allocs_total Blocks the plugin has allocated or reallocated.\n# TYPE julius_json_heap_allocs_total counter\njulius_json_heap_allocs_total %lu\n", HEAP_LOAD(&(heap.allocs)));
+  jw_printf(w, "# HELP julius_json_heap_frees_total Blocks the plugin has freed.\n# TYPE julius_json_heap_frees_total counter\njulius_json_heap_frees_total %lu\n", HEAP_LOAD(&(heap.frees)));
+  /* the queue is only detached at exit, never freed */
+  q = ATOMIC_LOAD(&record_queue);
+  if (q != NULL) {
+    jw_printf(w, "# HELP julius_json_queue_dropped_total Records dropped by the writer queue.\n# TYPE julius_json_queue_dropped_total counter\njulius_json_queue_dropped_total %lu\n", METRIC_LOAD(&(q->dropped)));
+  }
+
+  jw_printf(w, "# HELP julius_json_process_records_total Results per process and status.\n# TYPE julius_json_process_records_total counter\n");
+  for(e=ATOMIC_LOAD(&engine_root);e;e=e->next) {
+    for(i=0;i<e->metric_num;i++) {
+      m = &(e->metric[i]);
+      for(st=0;st<METRIC_STATUS;st++) {
+	if ((n = METRIC_LOAD(&(m->records[st]))) == 0) continue;
+	jw_printf(w, "julius_json_process_records_total");
+	metric_labels(w, e, m->r, st);
+	jw_printf(w, "} %lu\n", n);
+      }
+    }
+  }
+
+  jw_printf(w, "# HELP julius_json_latency_seconds Duration of the stages of an utterance.\n# TYPE julius_json_latency_seconds histogram\n");
+  for(e=ATOMIC_LOAD(&engine_root);e;e=e->next) {
+    for(i=0;i<e->metric_num;i++) {
+      m = &(e->metric[i]);
+      for(st=0;st<METRIC_STATUS;st++) {
+	for(j=0;j<METRIC_STAGE_NUM;j++) {
+	  h = &(m->hist[st][j]);
+	  if (METRIC_LOAD(&(h->count)) == 0) continue;
+	  n = 0;
+	  for(k=0;k<=METRIC_BUCKETS;k++) {
+	    n += METRIC_LOAD(&(h->bucket[k]));
+	    jw_printf(w, "julius_json_latency_seconds_bucket");
+	    metric_labels(w, e, m->r, st);
+	    if (k < METRIC_BUCKETS) {
+	      jw_printf(w, ",stage=\"%s\",le=\"%.9g\"} %lu\n", metric_stage_name[j], (double)(1LL << (10 + k)) / 1e9, n);
+	    } else {
+	      jw_printf(w, ",stage=\"%s\",le=\"+Inf\"} %lu\n", metric_stage_name[j], n);
+	    }
+	  }
+	  jw_printf(w, "julius_json_latency_seconds_sum");
+	  metric_labels(w, e, m->r, st);
+	  jw_printf(w, ",stage=\"%s\"} %.9f\n", metric_stage_name[j], METRIC_LOAD(&(h->sum)) / 1e9);
+	  jw_printf(w, "julius_json_latency_seconds_count");
+	  metric_labels(w, e, m->r, st);
+	  jw_printf(w, ",stage=\"%s\"} %lu\n", metric_stage_name[j], n);
+	}
+      }
+    }
+  }
+}
+
+/* rewrite the metrics file in one go, through a temporary file */
+static void
+metrics_write_file(JSONWriter *w)
+{
+  struct iovec iov;
+  char *tmp;
+  int fd;
+
+  tmp = (char *)json_malloc(strlen(json_conf.metrics) + 5);
+  sprintf(tmp, "%s.tmp", json_conf.metrics);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    iov.iov_base = w->buf;
+    iov.iov_len = w->len;
+    if (writev_all(fd, &iov, 1) && close(fd) == 0) {
+      rename(tmp, json_conf.metrics);
+    } else {
+      close(fd);
+      unlink(tmp);
+    }
+  }
+  json_free(tmp);
+}
+
+/**
+ * Exporter thread: rewrite the file at each interval until told to
+ * quit, or answer each connection to the socket with the current
+ * metrics.
+ */
+static void *
+metrics_main(void *arg)
+{
+  JSONWriter w;
+  struct pollfd pfd;
+  struct iovec iov;
+  struct timespec until;
+  int fd;
+
+  memset(&w, 0, sizeof(w));
+  if (metrics.listenfd < 0) {
+    pthread_mutex_lock(&(metrics.mutex));
+    while (! metrics.quit) {
+      metrics_format(&w);
+      metrics_write_file(&w);
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_sec += (json_conf.metrics_interval > 0) ? json_conf.metrics_interval : 15;
+      while (! metrics.quit && pthread_cond_timedwait(&(metrics.cond), &(metrics.mutex), &until) != ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&(metrics.mutex));
+    json_free(w.buf);
+    return NULL;
+  }
+  for(;;) {
+    pfd.fd = metrics.listenfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) <= 0) continue;
+    while ((fd = accept(metrics.listenfd, NULL, NULL)) >= 0) {
+      metrics_format(&w);
+      iov.iov_base = w.buf;
+      iov.iov_len = w.len;
+      writev_all(fd, &iov, 1);
+      close(fd);
+    }
+  }
+  return NULL;
+}
+
+static void
+metrics_finish()
+{
+  JSONWriter w;
+
+  if (metrics.listenfd >= 0) {
+    unlink(json_conf.metrics + 5);
+    return;
+  }
+  /* stop the writer, so that it cannot rename an older file over the
+     final one */
+  pthread_mutex_lock(&(metrics.mutex));
+  metrics.quit = TRUE;
+  pthread_cond_signal(&(metrics.cond));
+  pthread_mutex_unlock(&(metrics.mutex));
+  pthread_join(metrics.thread, NULL);
+  /* leave the final counts in the file */
+  memset(&w, 0, sizeof(w));
+  metrics_format(&w);
+  metrics_write_file(&w);
+  json_free(w.buf);
+}
+
+static boolean
+metrics_start()
+{
+  struct sockaddr_un sun;
+  char *path;
+  int fd;
+
+  metrics.listenfd = -1;
+  if (strncmp(json_conf.metrics, "unix:", 5) == 0) {
+    path = json_conf.metrics + 5;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+      jlog("ERROR: json: socket path too long: %s\n", path);
+      return FALSE;
+    }
+    strcpy(sun.sun_path, path);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, 4) < 0) {
+      jlog("ERROR: json: failed to listen on %s: %s\n", path, strerror(errno));
+      if (fd >= 0) close(fd);
+      return FALSE;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    metrics.listenfd = fd;
+  }
+  pthread_mutex_init(&(metrics.mutex), NULL);
+  pthread_cond_init(&(metrics.cond), NULL);
+  if (pthread_create(&(metrics.thread), NULL, metrics_main, NULL) != 0) {
+    jlog("ERROR: json: failed to create metrics thread\n");
+    return FALSE;
+  }
+  /* the file writer is joined at exit; the socket one just ends */
+  if (metrics.listenfd >= 0) pthread_detach(metrics.thread);
+  atexit(metrics_finish);
+  return TRUE;
+}
+
+/**
+ * Cache of the serialized word information.
+ *
+ * WORD, CLASSID and the joined PHONE string of a word never change
+ * while its dictionary is loaded, so they are escaped once on first
+ * use and copied into every later record.  An entry keeps a copy of
+ * the definition it was built from, and is rebuilt when the word no
+ * longer matches it, as after a grammar was added or swapped.  With
+ * "charset=", the values are converted to UTF-8 before they are
+ * escaped.
+ *
+ * Compact layouts list each word of a record once in a word table and
+ * refer to it by its index there; @a intern maps a WORD_ID to that
+ * index while the record is built.
+ */
+enum { WORD_CACHE_WORD, WORD_CACHE_CLASSID, WORD_CACHE_PHONE, WORD_CACHE_NUM };
+
+typedef struct {
+  char *src;			///< word_source_copy() the entry was built from
+  char *str;			///< escaped values, back to back
+  size_t len[WORD_CACHE_NUM];	///< length of each value in @a str
+} WordCacheEntry;
+
+typedef struct __word_cache__ {
+  PROCESS_LM *lm;		///< LM process this cache belongs to
+  CharConv *conv;		///< converter of the engine
+  char *scratch;		///< an entry being built
+  size_t scratch_size;		///< bytes allocated for @a scratch
+  int *intern;			///< index in the word table by WORD_ID, or -1
+  WORD_ID *table;		///< word table of the record being built
+  int table_num;		///< words in @a table
+  int table_size;		///< allocated length of @a table
+  WORD_INFO *winfo;		///< current dictionary of @a lm
+  WordCacheEntry *entry;	///< entries indexed by WORD_ID
+  int num;			///< number of allocated entries
+  struct __word_cache__ *next;
+} WordCache;
+
+/* get the cache for the current dictionary of @a r */
+static WordCache *
+word_cache_get(JSONEngine *e, RecogProcess *r)
+{
+  WordCache *wc;
+  WORD_INFO *winfo = r->lm->winfo;
+  int i;
+
+  for(wc=e->word_cache;wc;wc=wc->next) {
+    if (wc->lm == r->lm) break;
+  }
+  if (wc == NULL) {
+    wc = (WordCache *)json_malloc(sizeof(WordCache));
+    wc->lm = r->lm;
+    wc->conv = &(e->conv);
+    wc->scratch = NULL;
+    wc->scratch_size = 0;
+    wc->intern = NULL;
+    wc->table = NULL;
+    wc->table_num = 0;
+    wc->table_size = 0;
+    wc->winfo = NULL;
+    wc->entry = NULL;
+    wc->num = 0;
+    wc->next = e->word_cache;
+    e->word_cache = wc;
+  }
+  /* the entries are checked against the words, whatever the address */
+  wc->winfo = winfo;
+  if (wc->num < winfo->num) {
+    /* words have been added */
+    wc->entry = (WordCacheEntry *)json_realloc(wc->entry, sizeof(WordCacheEntry) * winfo->num);
+    memset(&(wc->entry[wc->num]), 0, sizeof(WordCacheEntry) * (winfo->num - wc->num));
+    wc->intern = (int *)json_realloc(wc->intern, sizeof(int) * winfo->num);
+    for(i=wc->num;i<winfo->num;i++) wc->intern[i] = -1;
+    wc->num = winfo->num;
+  }
+  return wc;
+}
+
+/* append @a str to the scratch of @a wc as value @a k of @a e, after @a n bytes */
+static size_t
+word_cache_add(WordCache *wc, WordCacheEntry *e, int k, const char *str, size_t n)
+{
+  size_t size;
+
+  str = charconv_utf8(wc->conv, str);
+  size = n + strlen(str) * 6 + 9;
+  if (wc->scratch_size < size) {
+    wc->scratch = (char *)json_realloc(wc->scratch, size);
+    wc->scratch_size = size;
+  }
+  e->len[k] = string_encode(wc->scratch + n, str);
+  return n + e->len[k];
+}
+
+static void
+word_cache_build(WordCache *wc, WordCacheEntry *e, WORD_ID w)
+{
+  WORD_INFO *winfo = wc->winfo;
+  char buf[MAX_HMMNAME_LEN];
+  char *word, *classid, *phone, *p;
+  size_t len, plen, n;
+  int j;
+
+  /* only what will be output; interim records and tables need the word too */
+  word = (FIELD_ON(FIELD_WHYPO_WORD) || json_conf.interim || FIELD_ON(FIELD_GRAPH) || FIELD_ON(FIELD_CONFNET)) ? winfo->woutput[w] : "";
+  classid = FIELD_ON(FIELD_WHYPO_CLASSID) ? winfo->wname[w] : "";
+  phone = NULL;
+  if (FIELD_ON(FIELD_WHYPO_PHONE)) {
+    /* join phones: each center name is shorter than its HMM name */
+    plen = 1;
+    for(j=0;j<winfo->wlen[w];j++) plen += strlen(winfo->wseq[w][j]->name) + 1;
+    phone = p = (char *)json_malloc(plen);
+    for(j=0;j<winfo->wlen[w];j++) {
+      center_name(winfo->wseq[w][j]->name, buf);
+      if (j > 0) *p++ = ' ';
+      len = strlen(buf);
+      memcpy(p, buf, len);
+      p += len;
+    }
+    *p = '\0';
+  }
+
+  n = word_cache_add(wc, e, WORD_CACHE_WORD, word, 0);
+  n = word_cache_add(wc, e, WORD_CACHE_CLASSID, classid, n);
+  if (phone != NULL) {
+    n = word_cache_add(wc, e, WORD_CACHE_PHONE, phone, n);
+    json_free(phone);
+  } else {
+    e->len[WORD_CACHE_PHONE] = 0;
+  }
+  if (e->str != NULL) json_free(e->str);
+  e->str = (char *)json_malloc(n);
+  memcpy(e->str, wc->scratch, n);
+  e->src = word_source_copy(e->src, winfo, w);
+}
+
+/* get the entry of word @a w, building it if not yet or out of date */
+static WordCacheEntry *
+word_cache_entry(WordCache *wc, WORD_ID w)
+{
+  WordCacheEntry *e;
+
+  e = &(wc->entry[w]);
+  if (! word_source_same(e->src, wc->winfo, w)) word_cache_build(wc, e, w);
+  return e;
+}
+
+/* index of word @a w in the word table of the record, adding it if new */
+static int
+word_intern(WordCache *wc, WORD_ID w)
 {
-  switch(opcode) {
-  case 0:
-    strncpy(buf, "output result with json format", buflen);
-    break;
+  if (wc->intern[w] < 0) {
+    if (wc->table_num == wc->table_size) {
+      wc->table_size = (wc->table_size == 0) ? 256 : wc->table_size * 2;
+      wc->table = (WORD_ID *)json_realloc(wc->table, sizeof(WORD_ID) * wc->table_size);
+    }
+    wc->intern[w] = wc->table_num;
+    wc->table[wc->table_num++] = w;
   }
-  return 0;
+  return wc->intern[w];
 }
 
-void
-result_best_str(char *result_str)
+/* output the word table as an array of words */
+static void
+word_table_out(WordCache *wc, JSONWriter *jw)
 {
-  if (result_str == NULL) {
-    json_object_set_string(root_object, "sentence", "");
-  } else {
-    json_object_set_string(root_object, "sentence", result_str);
+  WordCacheEntry *e;
+  int i;
+
+  jw_array_begin(jw);
+  for(i=0;i<wc->table_num;i++) {
+    e = word_cache_entry(wc, wc->table[i]);
+    jw_raw(jw, e->str, e->len[WORD_CACHE_WORD]);
   }
-  json_object_set_boolean(root_object, "succeeded", result_str != NULL);
+  jw_array_end(jw);
 }
 
-/**
- * Subroutine to output information of a recognition status.
- */
-static const char *get_status_info(int status)
+/* empty the word table for the next record */
+static void
+word_table_clear(WordCache *wc)
 {
-  const char *info = NULL;
-  switch(status) {
-  case J_RESULT_STATUS_SUCCESS:
-    info = "SUCCESS";
-    break;
-  case J_RESULT_STATUS_REJECT_POWER:
-    info = "REJECTED: by power";
-    break;
-  case J_RESULT_STATUS_TERMINATE:
-    info = "input terminated by request";
-    break;
-  case J_RESULT_STATUS_ONLY_SILENCE:
-    info = "REJECTED: result has pause words only";
-    break;
-  case J_RESULT_STATUS_REJECT_GMM:
-    info = "REJECTED: by GMM";
-    break;
-  case J_RESULT_STATUS_REJECT_SHORT:
-    info = "REJECTED: too short input";
-    break;
-  case J_RESULT_STATUS_REJECT_LONG:
-    info = "REJECTED: too long input";
-    break;
-  case J_RESULT_STATUS_FAIL:
-    info = "RECOGFAIL";
-    break;
-  default:
-    info = "UNKNOWN";
-  }
-  return info;
+  int i;
+
+  for(i=0;i<wc->table_num;i++) wc->intern[wc->table[i]] = -1;
+  wc->table_num = 0;
 }
 
 /**
  * Subroutine to output information of a recognized word at 2nd pass.
  */
 static void
-word_out_old(WORD_ID w, RecogProcess *r, JSON_Object *jo)
+word_out(WORD_ID w, WordCache *wc, JSONWriter *jw)
 {
-  int j;
-  static char buf[MAX_HMMNAME_LEN];
-  static char phone[MAX_HMMNAME_LEN*100];
-  WORD_INFO *winfo;
+  WordCacheEntry *e;
+  char *p;
 
-  winfo = r->lm->winfo;
-  jsonify("WORD", winfo->woutput[w]);
-  json_object_set_string(jo, "WORD", winfo->woutput[w]);
+  e = word_cache_entry(wc, w);
+  p = e->str;
+  if (FIELD_ON(FIELD_WHYPO_WORD)) {
+    jw_key(jw, "WORD");
+    jw_raw(jw, p, e->len[WORD_CACHE_WORD]);
+  }
+  p += e->len[WORD_CACHE_WORD];
+  if (FIELD_ON(FIELD_WHYPO_CLASSID)) {
+    jw_key(jw, "CLASSID");
+    jw_raw(jw, p, e->len[WORD_CACHE_CLASSID]);
+  }
+  p += e->len[WORD_CACHE_CLASSID];
+  if (FIELD_ON(FIELD_WHYPO_PHONE)) {
+    jw_key(jw, "PHONE");
+    jw_raw(jw, p, e->len[WORD_CACHE_PHONE]);
+  }
+}
 
-  jsonify_sep();
-  jsonify("CLASSID", winfo->wname[w]);
-  json_object_set_string(jo, "CLASSID", winfo->wname[w]);
+/* output the word table as an array of WHYPO objects */
+static void
+word_table_whypo_out(WordCache *wc, JSONWriter *jw)
+{
+  int i;
 
-  for(j=0;j<winfo->wlen[w];j++) {
-    center_name(winfo->wseq[w][j]->name, buf);
-    if (j == 0) snprintf(phone, MAX_HMMNAME_LEN*100, "%s", buf);
-    else snprintf(phone, MAX_HMMNAME_LEN*100, "%s %s", phone, buf);
+  jw_array_begin(jw);
+  for(i=0;i<wc->table_num;i++) {
+    jw_object_begin(jw);
+    word_out(wc->table[i], wc, jw);
+    jw_object_end(jw);
   }
-  jsonify_sep();
-  jsonify("PHONE", phone);
-  json_object_set_string(jo, "PHONE", phone);
+  jw_array_end(jw);
 }
 
 /**
- * Subroutine to output information of a recognized word at 2nd pass.
+ * Words of the last interim record of each process, to send only
+ * what has changed since.
  */
-static void
-word_out(WORD_ID w, RecogProcess *r, JSON_Object *jo)
+typedef struct __interim_state__ {
+  RecogProcess *r;
+  WORD_ID *word;		///< words already sent for this input
+  int num;			///< number of words in @a word
+  int size;			///< allocated length of @a word
+  int keep;			///< words still the same at current frame
+  struct __interim_state__ *next;
+} InterimState;
+
+static InterimState *
+interim_state_get(JSONEngine *e, RecogProcess *r)
 {
-  int j;
-  static char buf[MAX_HMMNAME_LEN];
-  static char phone[MAX_HMMNAME_LEN*100];
-  WORD_INFO *winfo;
-  winfo = r->lm->winfo;
+  InterimState *st;
 
-  json_object_set_string(jo, "WORD", winfo->woutput[w]);
-  json_object_set_string(jo, "CLASSID", winfo->wname[w]);
-  for(j=0;j<winfo->wlen[w];j++) {
-    center_name(winfo->wseq[w][j]->name, buf);
-    if (j == 0) snprintf(phone, MAX_HMMNAME_LEN*100, "%s", buf);
-    else snprintf(phone, MAX_HMMNAME_LEN*100, "%s %s", phone, buf);
+  for(st=e->interim_root;st;st=st->next) {
+    if (st->r == r) return st;
   }
-  json_object_set_string(jo, "PHONE", phone);
+  st = (InterimState *)json_malloc(sizeof(InterimState));
+  memset(st, 0, sizeof(InterimState));
+  st->r = r;
+  st->next = e->interim_root;
+  e->interim_root = st;
+  return st;
+}
+
+static void
+interim_reset(JSONEngine *e)
+{
+  InterimState *st;
+
+  for(st=e->interim_root;st;st=st->next) st->num = 0;
+  e->interim_emitted = FALSE;
 }
 
 /**
  * 1st pass: output when recognition begins (will be called at input start).
  */
 static void
-status_pass1_begin(Recog *recog, void *dummy)
+status_pass1_begin(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+
+  json_stamp(e, STAMP_PASS1_BEGIN);
   jlog("STAT: JSON: PASS1_STARTRECOG\n");
+  interim_reset(e);
 }
 
+/**
+ * 1st pass: output current best hypothesis as an interim record.
+ *
+ * The record only carries what changed since the last interim record
+ * of this input: KEEP is the number of leading words that are still
+ * the same, and WORDS are the ones that follow.  Nothing is output
+ * while the words stay the same, or before the interval given by
+ * "interim=msec" and "interimframes=N" has passed.
+ */
 static void
-result_pass1_current(Recog *recog, void *dummy)
+result_pass1_current(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+  RecogProcess *r;
+  Sentence *s;
+  InterimState *st;
+  WordCache *wc;
+  WordCacheEntry *we;
+  JSONWriter *jw = &(e->interim);
+  struct iovec iov[1];
+  boolean changed;
+  long long now;
+  int frame;
+  int i;
+
   jlog("STAT: JSON: PASS1_INTERIM\n");
+  if (! json_conf.interim) return;
+
+  changed = FALSE;
+  frame = 0;
+  for(r=recog->process_list;r;r=r->next) {
+    if (! r->live) continue;
+    if (! r->have_interim) continue;
+    s = &(r->result.pass1);
+    st = interim_state_get(e, r);
+    for(i=0;i<st->num && i<s->word_num;i++) {
+      if (st->word[i] != s->word[i]) break;
+    }
+    st->keep = i;
+    if (st->keep < st->num || st->keep < s->word_num) changed = TRUE;
+    if (frame < r->result.num_frame) frame = r->result.num_frame;
+  }
+  if (! changed) return;
+  now = json_clock();
+  if (e->interim_emitted) {
+    if (now - e->interim_last_time < json_conf.interim_msec * 1000000LL) return;
+    if (frame - e->interim_last_frame < json_conf.interim_frames) return;
+  }
+
+  jw_reset(jw);
+  jw_object_begin(jw);
+  if (ENGINE_TAGGED) jw_key_integer(jw, "ENGINE", e->id);
+  jw_key(jw, "INTERIM");
+  jw_array_begin(jw);
+  for(r=recog->process_list;r;r=r->next) {
+    if (! r->live) continue;
+    if (! r->have_interim) continue;
+    s = &(r->result.pass1);
+    st = interim_state_get(e, r);
+    if (st->keep == st->num && st->keep == s->word_num) continue;
+    wc = word_cache_get(e, r);
+
+    jw_object_begin(jw);
+    jw_key_integer(jw, "ID", r->config->id);
+    jw_key_string(jw, "NAME", r->config->name);
+    jw_key_integer(jw, "FRAME", r->result.num_frame);
+    jw_key_score(jw, "SCORE", s->score);
+    jw_key_integer(jw, "KEEP", st->keep);
+    jw_key(jw, "WORDS");
+    jw_array_begin(jw);
+    for(i=st->keep;i<s->word_num;i++) {
+      we = word_cache_entry(wc, s->word[i]);
+      jw_raw(jw, we->str, we->len[WORD_CACHE_WORD]);
+    }
+    jw_array_end(jw);
+    jw_object_end(jw);
+
+    /* remember what has been sent */
+    if (st->size < s->word_num) {
+      st->word = (WORD_ID *)json_realloc(st->word, sizeof(WORD_ID) * s->word_num);
+      st->size = s->word_num;
+    }
+    memcpy(st->word, s->word, sizeof(WORD_ID) * s->word_num);
+    st->num = s->word_num;
+  }
+  jw_array_end(jw);
+  if (record_queue != NULL) {
+    jw_key_integer(jw, "SEQ", e->seq++);
+  }
+  jw_object_end(jw);
+
+  iov[0].iov_base = jw->buf;
+  iov[0].iov_len = jw->len;
+  json_output(e, iov, 1, jw->len);
+
+  e->interim_emitted = TRUE;
+  e->interim_last_time = now;
+  e->interim_last_frame = frame;
 }
 
 static void
-result_pass1_final(Recog *recog, void *dummy)
+result_pass1_final(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
   RecogProcess *r;
-  JSON_Value *pass1_array = json_value_init_array();
-  json_object_set_value(root_object, "PASS1", pass1_array);
+  JSONWriter *jw = NULL;
+  long long t0 = json_clock();
 
+  if (FIELD_ON(FIELD_PASS1)) {
+    jw = member_begin(e, MEMBER_PASS1);
+    jw_array_begin(jw);
+  }
   for(r=recog->process_list;r;r=r->next) {
     if (! r->live) continue;
-    JSON_Value *pass1_value = json_value_init_object();
-    json_array_append_value(json_value_get_array(pass1_array), pass1_value);
-    JSON_Object *pass1_object = json_value_get_object(pass1_value);
-
-    json_object_set_number(pass1_object, "ID", r->config->id);
-    json_object_set_string(pass1_object, "NAME", r->config->name);
-    json_object_set_string(pass1_object, "STATUS", get_status_info(r->result.status));
-    json_object_set_boolean(pass1_object, "succeeded", r->result.status >= 0);
+    if (jw != NULL) {
+      jw_object_begin(jw);
+      process_status_out(r, jw);
+      jw_object_end(jw);
+    }
 
     if (r->result.status < 0) {
       output("succeeded:false, ID:SR%02d, NAME:%s, STATUS:%s\n", r->config->id, r->config->name, get_status_info(r->result.status));
@@ -229,18 +4491,105 @@ result_pass1_final(Recog *recog, void *dummy)
       output("succeeded:true, ID:SR%02d, NAME:%s, STATUS:%s\n", r->config->id, r->config->name, get_status_info(r->result.status));
     }
   }
+  if (jw != NULL) jw_array_end(jw);
+  json_stamp_build(e, t0);
 }
 
 /**
  * 1st pass: end of output (will be called at the end of the 1st pass).
  */
 static void
-status_pass1_end(Recog *recog, void *dummy)
+status_pass1_end(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+
+  json_stamp(e, STAMP_PASS1_END);
   jlog("STAT: JSON: PASS1_ENDRECOG\n");
   nop();
 }
 
+/**
+ * Subroutine to output a phoneme or state alignment of a sentence, as
+ * given by "-palign" and "-salign".
+ *
+ * A state alignment of a minute of speech has tens of thousands of
+ * units, so each attribute of the units is an array of its own:
+ * BEGINFRAME, ENDFRAME, SCORE (average acoustic score per frame) and
+ * UNIT (logical HMM name), and STATE (state number) for states.
+ */
+static void
+align_out(SentenceAlign *align, JSONWriter *jw)
+{
+  int i;
+
+  jw_object_begin(jw);
+  jw_key(jw, "BEGINFRAME");
+  jw_array_begin(jw);
+  for(i=0;i<align->num;i++) jw_integer(jw, align->begin_frame[i]);
+  jw_array_end(jw);
+  jw_key(jw, "ENDFRAME");
+  jw_array_begin(jw);
+  for(i=0;i<align->num;i++) jw_integer(jw, align->end_frame[i]);
+  jw_array_end(jw);
+  jw_key(jw, "SCORE");
+  jw_array_begin(jw);
+  for(i=0;i<align->num;i++) jw_float(jw, align->avgscore[i], json_conf.scoredigits);
+  jw_array_end(jw);
+  jw_key(jw, "UNIT");
+  jw_array_begin(jw);
+  for(i=0;i<align->num;i++) jw_string(jw, align->ph[i]->name);
+  jw_array_end(jw);
+  if (align->unittype == PER_STATE) {
+    jw_key(jw, "STATE");
+    jw_array_begin(jw);
+    for(i=0;i<align->num;i++) jw_integer(jw, align->loc[i]);
+    jw_array_end(jw);
+  }
+  jw_key_score(jw, "ALLSCORE", align->allscore);
+  jw_object_end(jw);
+}
+
+/**
+ * Subroutine to output the words of a sentence with "nbest=compact",
+ * one array per attribute: WORD, indices into the WORDS of the
+ * process, CM, and BEGINFRAME and ENDFRAME of the word alignment.
+ */
+static void
+whypo_columns_out(Sentence *s, WordCache *wc, JSONWriter *jw)
+{
+  SentenceAlign *align;
+  int i;
+
+  if (FIELD_ON(FIELD_WHYPO_WORD) || FIELD_ON(FIELD_WHYPO_CLASSID) || FIELD_ON(FIELD_WHYPO_PHONE)) {
+    jw_key(jw, "WORD");
+    jw_array_begin(jw);
+    for(i=0;i<s->word_num;i++) jw_integer(jw, wc->intern[s->word[i]]);
+    jw_array_end(jw);
+  }
+#ifdef CONFIDENCE_MEASURE
+#ifndef CM_MULTIPLE_ALPHA
+  if (FIELD_ON(FIELD_WHYPO_CM)) {
+    jw_key(jw, "CM");
+    jw_array_begin(jw);
+    for(i=0;i<s->word_num;i++) jw_float(jw, s->confidence[i], json_conf.cmdigits);
+    jw_array_end(jw);
+  }
+#endif
+#endif /* CONFIDENCE_MEASURE */
+  if (! FIELD_ON(FIELD_WHYPO_FRAME)) return;
+  for (align = s->align; align; align = align->next) {
+    if (align->unittype != PER_WORD) continue;
+    jw_key(jw, "BEGINFRAME");
+    jw_array_begin(jw);
+    for(i=0;i<s->word_num;i++) jw_integer(jw, align->begin_frame[i]);
+    jw_array_end(jw);
+    jw_key(jw, "ENDFRAME");
+    jw_array_begin(jw);
+    for(i=0;i<s->word_num;i++) jw_integer(jw, align->end_frame[i]);
+    jw_array_end(jw);
+  }
+}
+
 /**
  * 2nd pass: output a sentence hypothesis found in the 2nd pass.
  *
@@ -249,262 +4598,302 @@ status_pass1_end(Recog *recog, void *dummy)
  * @param winfo [in] word dictionary
  */
 static void
-result_pass2_old(Recog *recog, void *dummy)
+result_pass2(Recog *recog, void *data)
 {
-  int i, n, num;
-  WORD_INFO *winfo;
+  JSONEngine *e = engine_enter(data);
+  int i, n;
   WORD_ID *seq;
   int seqnum;
   Sentence *s;
   RecogProcess *r;
   SentenceAlign *align;
+  WordCache *wc;
+  JSONWriter *jw;
 
-  //JSON_Value *root_value = json_value_init_object();
-  //JSON_Object *root_object = json_value_get_object(root_value);
-
-  JSON_Value *json_recog = json_value_init_array();
-  json_object_set_value(root_object, "RECOGOUT", json_recog);
-  output("{\"RECOGOUT\":[\n");
+  json_stamp(e, STAMP_RESULT);
+  if (! FIELD_ON(FIELD_RECOGOUT)) return;
+  jw = member_begin(e, MEMBER_RECOGOUT);
+  jw_array_begin(jw);
   for(r=recog->process_list;r;r=r->next) {
     if (! r->live) continue;
-    JSON_Value *recogout_value = json_value_init_object();
-    json_array_append_value(json_value_get_array(json_recog), recogout_value);
-    JSON_Object *recogout_object = json_value_get_object(recogout_value);
-
-    output("  {");
+    jw_object_begin(jw);
+    process_status_out(r, jw);
 
-    jsonify_fmt("ID", r->config->id, "SR%02d");
-    json_object_set_number(recogout_object, "ID", r->config->id);
-
-    jsonify_sep();
-    jsonify("NAME", r->config->name);
-    json_object_set_string(recogout_object, "NAME", r->config->name);
-
-    jsonify_sep();
-    jsonify("STATUS", get_status_info(r->result.status));
-    json_object_set_string(recogout_object, "STATUS", get_status_info(r->result.status));
-
-    if (r->result.status < 0) {
-      json_object_set_boolean(recogout_object, "succeeded", FALSE);
-      jsonify_sep();
-      jsonify_boolean("succeeded", FALSE);
-      output("}\n");
-      printf("JSON> %s\n", json_serialize_to_string(root_value));
+    if (r->result.status < 0 || ! (json_conf.fields & FIELDS_SHYPO)) {
+      jw_object_end(jw);
       continue;
-    } else {
-      json_object_set_boolean(recogout_object, "succeeded", TRUE);
-      jsonify_sep();
-      jsonify_boolean("succeeded", TRUE);
     }
 
-    winfo = r->lm->winfo;
-    //num = r->result.sentnum;
-
-    jsonify_sep();
-    output("\n    \"SHYPO\":[\n");
-    JSON_Value *json_shypo = json_value_init_array();
-    json_object_dotset_value(recogout_object, "SHYPO", json_shypo);
+    wc = word_cache_get(e, r);
+    if (json_conf.nbest_compact && (json_conf.fields & FIELDS_WHYPO)) {
+      /* the words of all hypotheses, each once */
+      for(n=0;n<r->result.sentnum;n++) {
+	s = &(r->result.sent[n]);
+	for(i=0;i<s->word_num;i++) word_intern(wc, s->word[i]);
+      }
+      if (FIELD_ON(FIELD_WHYPO_WORD) || FIELD_ON(FIELD_WHYPO_CLASSID) || FIELD_ON(FIELD_WHYPO_PHONE)) {
+	jw_key(jw, "WORDS");
+	word_table_whypo_out(wc, jw);
+      }
+    }
 
+    jw_key(jw, "SHYPO");
+    jw_array_begin(jw);
     for(n=0;n<r->result.sentnum;n++) {
-      JSON_Value *shypo_value = json_value_init_object();
-      json_array_append_value(json_value_get_array(json_shypo), shypo_value);
-      JSON_Object *shypo_object = json_value_get_object(shypo_value);
-
       s = &(r->result.sent[n]);
       seq = s->word;
       seqnum = s->word_num;
 
-      output("      {");
-      jsonify_integer("RANK", n+1);
-      json_object_set_number(shypo_object, "RANK", n+1);
+      jw_object_begin(jw);
+      if (FIELD_ON(FIELD_SHYPO_RANK)) jw_key_integer(jw, "RANK", n+1);
 #ifdef USE_MBR
-      if(r->config->mbr.use_mbr == TRUE){
-        jsonify_sep();
-        jsonify_float("MBRSCORE", s->score_mbr);
-        json_object_set_number(shypo_object, "MBRSCORE", s->score_mbr);
+      if(r->config->mbr.use_mbr == TRUE && FIELD_ON(FIELD_SHYPO_MBRSCORE)){
+        jw_key_score(jw, "MBRSCORE", s->score_mbr);
       }
 #endif
-      jsonify_sep();
-      jsonify_float("SCORE", s->score);
-      json_object_set_number(shypo_object, "SCORE", s->score);
+      if (FIELD_ON(FIELD_SHYPO_SCORE)) jw_key_score(jw, "SCORE", s->score);
       if (r->lmtype == LM_PROB) {
-        jsonify_sep();
-        jsonify_float("AMSCORE", s->score_am);
-        json_object_set_number(shypo_object, "AMSCORE", s->score_am);
-        jsonify_sep();
-        jsonify_float("LMSCORE", s->score_lm);
-        json_object_set_number(shypo_object, "LMSCORE", s->score_lm);
-      }
-      if (r->lmtype == LM_DFA) {
+        if (FIELD_ON(FIELD_SHYPO_AMSCORE)) jw_key_score(jw, "AMSCORE", s->score_am);
+        if (FIELD_ON(FIELD_SHYPO_LMSCORE)) jw_key_score(jw, "LMSCORE", s->score_lm);
+      }
+      if (r->lmtype == LM_DFA && FIELD_ON(FIELD_SHYPO_GRAM)) {
         /* output which grammar the best hypothesis belongs to */
-        jsonify_sep();
-        jsonify_integer("GRAM", s->gram_id);
-        json_object_set_number(shypo_object, "GRAM", s->gram_id);
+        jw_key_integer(jw, "GRAM", s->gram_id);
+      }
+      if (FIELD_ON(FIELD_SHYPO_ALIGN)) {
+        for (align = s->align; align; align = align->next) {
+          if (align->unittype == PER_PHONEME) {
+            jw_key(jw, "PHONEALIGN");
+            align_out(align, jw);
+          } else if (align->unittype == PER_STATE) {
+            jw_key(jw, "STATEALIGN");
+            align_out(align, jw);
+          }
+        }
+      }
+      if (! (json_conf.fields & FIELDS_WHYPO)) {
+	jw_object_end(jw);
+	continue;
+      }
+      if (json_conf.nbest_compact) {
+	whypo_columns_out(s, wc, jw);
+	jw_object_end(jw);
+	continue;
       }
 
       /*** WHYPO ***/
-      jsonify_sep();
-      output("\n        \"WHYPO\":[\n");
-      JSON_Value *json_whypo = json_value_init_array();
-      json_object_set_value(shypo_object, "WHYPO", json_whypo);
-
+      jw_key(jw, "WHYPO");
+      jw_array_begin(jw);
       for (i=0;i<seqnum;i++) {
-        JSON_Value *whypo_value = json_value_init_object();
-        json_array_append_value(json_value_get_array(json_whypo), whypo_value);
-        JSON_Object *whypo_object = json_value_get_object(whypo_value);
-
-        output("          {");
-        word_out(seq[i], r, whypo_object);
+        jw_object_begin(jw);
+        word_out(seq[i], wc, jw);
 #ifdef CONFIDENCE_MEASURE
 #ifdef CM_MULTIPLE_ALPHA
         /* currently not handle multiple alpha output */
 #else
-        jsonify_sep();
-        jsonify_float("CM", s->confidence[i]);
-        json_object_set_number(whypo_object, "CM", s->confidence[i]);
+        if (FIELD_ON(FIELD_WHYPO_CM)) jw_key_cm(jw, "CM", s->confidence[i]);
 #endif
 #endif /* CONFIDENCE_MEASURE */
         /* output alignment result if exist */
+        if (! FIELD_ON(FIELD_WHYPO_FRAME)) {
+          jw_object_end(jw);
+          continue;
+        }
         for (align = s->align; align; align = align->next) {
-          switch(align->unittype) {
-            case PER_WORD:	/* word alignment */
-              jsonify_sep();
-              jsonify_integer("BEGINFRAME", align->begin_frame[i]);
-              json_object_set_number(whypo_object, "BEGINFRAME", align->begin_frame[i]);
-              jsonify_sep();
-              jsonify_integer("ENDFRAME", align->end_frame[i]);
-              json_object_set_number(whypo_object, "ENDFRAME", align->end_frame[i]);
-              break;
-            case PER_PHONEME:
-            case PER_STATE:
-              fprintf(stderr, "Error: \"-palign\" and \"-salign\" does not supported for module output\n");
-              break;
+          if (align->unittype == PER_WORD) {
+            jw_key_integer(jw, "BEGINFRAME", align->begin_frame[i]);
+            jw_key_integer(jw, "ENDFRAME", align->end_frame[i]);
           }
         }
-        if (i+1<seqnum) output("},\n");
-        else output("}\n");
+        jw_object_end(jw);
       }
-      output("        ]\n");
-      if (n+1<r->result.sentnum) output("      },\n");
-      else output("      }\n");
+      jw_array_end(jw);
+      jw_object_end(jw);
     }
-    output("    ]\n");
-
-    if (r->next) output("  },\n");
-    else output("  }]\n");
+    jw_array_end(jw);
+    jw_object_end(jw);
+    word_table_clear(wc);
   }
-  output("}\n");
+  jw_array_end(jw);
+  json_stamp_build(e, e->stamp[STAMP_RESULT]);
   return;
 }
 
+/* a column of the nodes from @a root: the score at @a offset of each */
+static void
+graph_column(JSONWriter *jw, const char *key, WordGraph *root, size_t offset, int digits)
+{
+  WordGraph *wg;
+
+  jw_key(jw, key);
+  jw_array_begin(jw);
+  for(wg=root;wg;wg=wg->next) {
+    jw_float(jw, *(LOGPROB *)((char *)wg + offset), digits);
+  }
+  jw_array_end(jw);
+}
+
 /**
- * 2nd pass: output a sentence hypothesis found in the 2nd pass.
+ * Output the word graph of the 2nd pass, given by "-graphout".
  *
- * @param hypo [in] sentence hypothesis to be output
- * @param rank [in] rank of @a hypo
- * @param winfo [in] word dictionary
+ * A lattice can have tens of thousands of arcs, so it is laid out
+ * flat: WORDS lists each word of the lattice once, NODE has a
+ * parallel array per attribute with WORD as indices into WORDS, and
+ * ARC has the IDs of the two nodes of each arc, from and to, one arc
+ * after another.  A node ID is its index in the NODE arrays.
  */
 static void
-result_pass2(Recog *recog, void *dummy)
+result_graph(Recog *recog, void *data)
 {
-  int i, n, num;
-  WORD_INFO *winfo;
-  WORD_ID *seq;
-  int seqnum;
-  Sentence *s;
+  JSONEngine *e = engine_enter(data);
   RecogProcess *r;
-  SentenceAlign *align;
+  WordGraph *wg, *root;
+  WordCache *wc;
+  JSONWriter *jw;
+  int i, nodenum, arcnum;
+  long long t0 = json_clock();
 
-  JSON_Value *json_recog = json_value_init_array();
-  json_object_set_value(root_object, "RECOGOUT", json_recog);
+  if (! FIELD_ON(FIELD_GRAPH)) return;
+  for(r=recog->process_list;r;r=r->next) {
+    if (r->live && r->result.wg != NULL) break;
+  }
+  if (r == NULL) return;
+  jw = member_begin(e, MEMBER_GRAPH);
+  jw_array_begin(jw);
   for(r=recog->process_list;r;r=r->next) {
     if (! r->live) continue;
-    JSON_Value *recogout_value = json_value_init_object();
-    json_array_append_value(json_value_get_array(json_recog), recogout_value);
-    JSON_Object *recogout_object = json_value_get_object(recogout_value);
-
-    json_object_set_number(recogout_object, "ID", r->config->id);
-    json_object_set_string(recogout_object, "NAME", r->config->name);
-    json_object_set_string(recogout_object, "STATUS", get_status_info(r->result.status));
-    json_object_set_boolean(recogout_object, "succeeded", r->result.status >= 0);
-
-    if (r->result.status < 0) {
-      continue;
+    if (r->result.wg == NULL) continue; /* no graphout specified */
+    root = r->result.wg;
+    wc = word_cache_get(e, r);
+    nodenum = arcnum = 0;
+    for(wg=root;wg;wg=wg->next) {
+      word_intern(wc, wg->wid);
+      nodenum++;
+      arcnum += wg->rightwordnum;
     }
-    winfo = r->lm->winfo;
-    JSON_Value *json_shypo = json_value_init_array();
-    json_object_dotset_value(recogout_object, "SHYPO", json_shypo);
-
-    for(n=0;n<r->result.sentnum;n++) {
-      JSON_Value *shypo_value = json_value_init_object();
-      json_array_append_value(json_value_get_array(json_shypo), shypo_value);
-      JSON_Object *shypo_object = json_value_get_object(shypo_value);
 
-      s = &(r->result.sent[n]);
-      seq = s->word;
-      seqnum = s->word_num;
+    jw_object_begin(jw);
+    jw_key_integer(jw, "ID", r->config->id);
+    jw_key_string(jw, "NAME", r->config->name);
+    jw_key_integer(jw, "NODENUM", nodenum);
+    jw_key_integer(jw, "ARCNUM", arcnum);
+    jw_key(jw, "WORDS");
+    word_table_out(wc, jw);
 
-      json_object_set_number(shypo_object, "RANK", n+1);
-#ifdef USE_MBR
-      if(r->config->mbr.use_mbr == TRUE){
-        json_object_set_number(shypo_object, "MBRSCORE", s->score_mbr);
-      }
+    jw_key(jw, "NODE");
+    jw_object_begin(jw);
+    jw_key(jw, "WORD");
+    jw_array_begin(jw);
+    for(wg=root;wg;wg=wg->next) jw_integer(jw, wc->intern[wg->wid]);
+    jw_array_end(jw);
+    jw_key(jw, "BEGINFRAME");
+    jw_array_begin(jw);
+    for(wg=root;wg;wg=wg->next) jw_integer(jw, wg->lefttime);
+    jw_array_end(jw);
+    jw_key(jw, "ENDFRAME");
+    jw_array_begin(jw);
+    for(wg=root;wg;wg=wg->next) jw_integer(jw, wg->righttime);
+    jw_array_end(jw);
+    graph_column(jw, "AMAVG", root, offsetof(WordGraph, amavg), json_conf.scoredigits);
+    graph_column(jw, "FORWARD", root, offsetof(WordGraph, fscore_head), json_conf.scoredigits);
+    graph_column(jw, "BACKWARD", root, offsetof(WordGraph, gscore_tail), json_conf.scoredigits);
+#ifdef CONFIDENCE_MEASURE
+    graph_column(jw, "CM", root, offsetof(WordGraph, graph_cm), json_conf.cmdigits);
 #endif
-      json_object_set_number(shypo_object, "SCORE", s->score);
-      if (r->lmtype == LM_PROB) {
-        json_object_set_number(shypo_object, "AMSCORE", s->score_am);
-        json_object_set_number(shypo_object, "LMSCORE", s->score_lm);
-      }
-      if (r->lmtype == LM_DFA) {
-        /* output which grammar the best hypothesis belongs to */
-        json_object_set_number(shypo_object, "GRAM", s->gram_id);
+    jw_object_end(jw);
+
+    jw_key(jw, "ARC");
+    jw_array_begin(jw);
+    for(wg=root;wg;wg=wg->next) {
+      for(i=0;i<wg->rightwordnum;i++) {
+	jw_integer(jw, wg->id);
+	jw_integer(jw, wg->rightword[i]->id);
       }
+    }
+    jw_array_end(jw);
+    jw_object_end(jw);
+    word_table_clear(wc);
+  }
+  jw_array_end(jw);
+  json_stamp_build(e, t0);
+}
 
-      /*** WHYPO ***/
-      JSON_Value *json_whypo = json_value_init_array();
-      json_object_set_value(shypo_object, "WHYPO", json_whypo);
+/**
+ * Output the confusion network of the 2nd pass, given by "-confnet".
+ *
+ * Each process has WORDS, the words of its network listed once, and
+ * SLOT, the clusters of competing words in order of time.  A slot has
+ * WORD, indices into WORDS with -1 for skipping the slot, and PP, the
+ * posterior of each.
+ */
+static void
+result_confnet(Recog *recog, void *data)
+{
+  JSONEngine *e = engine_enter(data);
+  RecogProcess *r;
+  CN_CLUSTER *c;
+  WordCache *wc;
+  JSONWriter *jw;
+  int i;
+  long long t0 = json_clock();
 
-      for (i=0;i<seqnum;i++) {
-        JSON_Value *whypo_value = json_value_init_object();
-        json_array_append_value(json_value_get_array(json_whypo), whypo_value);
-        JSON_Object *whypo_object = json_value_get_object(whypo_value);
+  if (! FIELD_ON(FIELD_CONFNET)) return;
+  for(r=recog->process_list;r;r=r->next) {
+    if (r->live && r->result.confnet != NULL) break;
+  }
+  if (r == NULL) return;
+  jw = member_begin(e, MEMBER_CONFNET);
+  jw_array_begin(jw);
+  for(r=recog->process_list;r;r=r->next) {
+    if (! r->live) continue;
+    if (r->result.confnet == NULL) continue; /* no confnet specified */
+    wc = word_cache_get(e, r);
+    for(c=r->result.confnet;c;c=c->next) {
+      for(i=0;i<c->wseqnum;i++) {
+	if (c->wseq[i] != WORD_INVALID) word_intern(wc, c->wseq[i]);
+      }
+    }
 
-        word_out(seq[i], r, whypo_object);
-#ifdef CONFIDENCE_MEASURE
-#ifdef CM_MULTIPLE_ALPHA
-        /* currently not handle multiple alpha output */
-#else
-        json_object_set_number(whypo_object, "CM", s->confidence[i]);
-#endif
-#endif /* CONFIDENCE_MEASURE */
-        /* output alignment result if exist */
-        for (align = s->align; align; align = align->next) {
-          switch(align->unittype) {
-            case PER_WORD:	/* word alignment */
-              json_object_set_number(whypo_object, "BEGINFRAME", align->begin_frame[i]);
-              json_object_set_number(whypo_object, "ENDFRAME", align->end_frame[i]);
-              break;
-            case PER_PHONEME:
-            case PER_STATE:
-              fprintf(stderr, "Error: \"-palign\" and \"-salign\" does not supported for module output\n");
-              break;
-          }
-        }
+    jw_object_begin(jw);
+    jw_key_integer(jw, "ID", r->config->id);
+    jw_key_string(jw, "NAME", r->config->name);
+    jw_key(jw, "WORDS");
+    word_table_out(wc, jw);
+    jw_key(jw, "SLOT");
+    jw_array_begin(jw);
+    for(c=r->result.confnet;c;c=c->next) {
+      jw_object_begin(jw);
+      jw_key(jw, "WORD");
+      jw_array_begin(jw);
+      for(i=0;i<c->wseqnum;i++) {
+	jw_integer(jw, (c->wseq[i] == WORD_INVALID) ? -1 : wc->intern[c->wseq[i]]);
       }
+      jw_array_end(jw);
+      jw_key(jw, "PP");
+      jw_array_begin(jw);
+      for(i=0;i<c->wseqnum;i++) jw_float(jw, c->pp[i], json_conf.cmdigits);
+      jw_array_end(jw);
+      jw_object_end(jw);
     }
+    jw_array_end(jw);
+    jw_object_end(jw);
+    word_table_clear(wc);
   }
-  return;
+  jw_array_end(jw);
+  json_stamp_build(e, t0);
 }
 
-
 /**
  * Output when ready to recognize and start waiting speech input.
  */
 static void
-status_recready(Recog *recog, void *dummy)
+status_recready(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+
+  json_stamp(e, STAMP_READY);
   jlog("STAT: JSON: INPUT STATUS=LISTEN TIME=%ld\n", time(NULL));
-  json_object_dotset_number(root_object, "TIME.LISTEN", time(NULL));
+  json_set_time(e, TIME_LISTEN);
   nop();
 }
 
@@ -512,50 +4901,65 @@ status_recready(Recog *recog, void *dummy)
  * Output when input starts.
  */
 static void
-status_recstart(Recog *recog, void *dummy)
+status_recstart(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+
+  json_stamp(e, STAMP_START);
   jlog("STAT: JSON: INPUT STATUS=STARTREC TIME=%ld\n", time(NULL));
-  json_object_dotset_number(root_object, "TIME.STARTREC", time(NULL));
+  json_set_time(e, TIME_STARTREC);
 }
 /**
  * Output when input ends.
  */
 static void
-status_recend(Recog *recog, void *dummy)
+status_recend(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
+
+  json_stamp(e, STAMP_STOP);
   jlog("STAT: JSON: INPUT STATUS=ENDREC TIME=%ld\n", time(NULL));
-  json_object_dotset_number(root_object, "TIME.ENDREC", time(NULL));
+  json_set_time(e, TIME_ENDREC);
 }
 /**
  * Output input parameter status such as length.
  */
 static void
-status_param(Recog *recog, void *dummy)
+status_param(Recog *recog, void *data)
 {
+  JSONEngine *e = engine_enter(data);
   MFCCCalc *mfcc;
   int frames;
   int msec;
+  JSONWriter *jw;
+  long long t0 = json_clock();
 
+  e->stamp_msec = (float)recog->mfcclist->param->samplenum * (float)recog->jconf->input.period * (float)recog->jconf->input.frameshift / 10000.0;
+  e->frames = recog->mfcclist->param->samplenum;
+  if (! FIELD_ON(FIELD_INPUT)) return;
+  jw = member_begin(e, MEMBER_INPUT);
   if (recog->mfcclist->next != NULL)
   {
-    JSON_Value *inputstatus = json_value_init_array();
-    json_object_set_value(root_object, "INPUT", inputstatus);
+    jw_array_begin(jw);
     for(mfcc=recog->mfcclist;mfcc;mfcc=mfcc->next) {
-      JSON_Value *input = json_value_init_object();
-      json_array_append_value(json_value_get_array(inputstatus), input);
-      JSON_Object *input_object = json_value_get_object(input);
       frames = mfcc->param->samplenum;
       msec = (float)mfcc->param->samplenum * (float)recog->jconf->input.period * (float)recog->jconf->input.frameshift / 10000.0;
-      json_object_dotset_number(input_object, "MFCCID", mfcc->id);
-      json_object_dotset_number(input_object, "FRAMES", frames);
-      json_object_dotset_number(input_object, "MSEC", msec);
+      jw_object_begin(jw);
+      jw_key_integer(jw, "MFCCID", mfcc->id);
+      jw_key_integer(jw, "FRAMES", frames);
+      jw_key_integer(jw, "MSEC", msec);
+      jw_object_end(jw);
     }
+    jw_array_end(jw);
   } else {
     frames = recog->mfcclist->param->samplenum;
     msec = (float)recog->mfcclist->param->samplenum * (float)recog->jconf->input.period * (float)recog->jconf->input.frameshift / 10000.0;
-    json_object_dotset_number(root_object, "INPUT.FRAMES", frames);
-    json_object_dotset_number(root_object, "INPUT.MSEC", msec);
+    jw_object_begin(jw);
+    jw_key_integer(jw, "FRAMES", frames);
+    jw_key_integer(jw, "MSEC", msec);
+    jw_object_end(jw);
   }
+  json_stamp_build(e, t0);
 }
 
 /**
@@ -564,12 +4968,19 @@ status_param(Recog *recog, void *dummy)
  * </EN>
  */
 static void
-result_gmm(Recog *recog, void *dummy)
+result_gmm(Recog *recog, void *data)
 {
-  json_object_dotset_string(root_object, "GMM.RESULT", recog->gc->max_d->name);
+  JSONEngine *e = engine_enter(data);
+  JSONWriter *jw;
+
+  if (! FIELD_ON(FIELD_GMM)) return;
+  jw = member_begin(e, MEMBER_GMM);
+  jw_object_begin(jw);
+  jw_key_string(jw, "RESULT", recog->gc->max_d->name);
 #ifdef CONFIDENCE_MEASURE
-  json_object_dotset_number(root_object, "GMM.CMSCORE", recog->gc->gmm_max_cm);
+  jw_key_cm(jw, "CMSCORE", recog->gc->gmm_max_cm);
 #endif
+  jw_object_end(jw);
 }
 
 static void
@@ -579,40 +4990,144 @@ notify_segment_end(Recog *recog, void *dummy)
 }
 
 static void
-set_json_result_status(Recog *recog) {
+set_json_result_status(JSONEngine *e, Recog *recog) {
   RecogProcess *r;
-  JSON_Value *status_array = json_value_init_array();
-  json_object_set_value(root_object, "result", status_array);
+  JSONWriter *jw;
+  long long t0;
+
+  if (! FIELD_ON(FIELD_RESULT)) return;
+  t0 = json_clock();
+  jw = member_begin(e, MEMBER_RESULT);
+  jw_array_begin(jw);
   for(r=recog->process_list;r;r=r->next) {
     if (! r->live) continue;
-    JSON_Value *status = json_value_init_object();
-    json_array_append_value(json_value_get_array(status_array), status);
-    JSON_Object *status_object = json_value_get_object(status);
+    jw_object_begin(jw);
+    process_status_out(r, jw);
+    jw_object_end(jw);
+  }
+  jw_array_end(jw);
+  json_stamp_build(e, t0);
+}
+
+/**
+ * Where the input of a record came from: FILE, the input file, and
+ * SEGMENT and OFFSET, the records and frames of input that came from
+ * the same file before it, so that the segments of a long file can
+ * be told apart and put in order.
+ */
+static void
+json_set_source(JSONEngine *e, Recog *recog)
+{
+  JSONWriter *jw;
+  char *name;
 
-    json_object_set_number(status_object, "ID", r->config->id);
-    json_object_set_string(status_object, "NAME", r->config->name);
-    json_object_set_string(status_object, "STATUS", get_status_info(r->result.status));
-    json_object_set_boolean(status_object, "succeeded", r->result.status >= 0);
+  name = j_get_current_filename(recog);
+  if (name == NULL) name = "";
+  if (e->source == NULL || ! strmatch(e->source, name)) {
+    if (e->source != NULL) json_free(e->source);
+    e->source = (char *)json_malloc(strlen(name) + 1);
+    strcpy(e->source, name);
+    e->source_segment = 0;
+    e->source_offset = 0;
+  }
+  if (FIELD_ON(FIELD_SOURCE)) {
+    jw = member_begin(e, MEMBER_SOURCE);
+    jw_object_begin(jw);
+    jw_key_string(jw, "FILE", charconv_utf8(&(e->conv), name));
+    jw_key_integer(jw, "SEGMENT", e->source_segment);
+    jw_key_integer(jw, "OFFSET", e->source_offset);
+    jw_object_end(jw);
   }
+  e->source_segment++;
+  e->source_offset += e->frames;
 }
 
+/* counts last warned about, by whichever engine saw them first */
+static unsigned long queue_dropped = 0;
+static unsigned long ring_toolarge = 0;
+
 static void
-notify_recog_end(Recog *recog, void *dummy)
+notify_recog_end(Recog *recog, void *data)
 {
-  set_json_result_status(recog);
-  //printf("%s\n", json_serialize_to_string_pretty(root_value));
-  printf("JSON> %s\n", json_serialize_to_string(root_value));
-  json_init();
-  jlog("STAT: JSON: CALLBACK_EVENT_RECOGNITION_END");
+  JSONEngine *e = engine_enter(data);
+  JSONWriter *jw;
+  unsigned long n;
+  size_t len;
+
+  set_json_result_status(e, recog);
+  if (FIELD_ON(FIELD_SOURCE)) json_set_source(e, recog);
+  json_set_latency(e);
+  if (record_queue != NULL) {
+    jw = member_begin(e, MEMBER_SEQ);
+    jw_integer(jw, e->seq++);
+  }
+  len = json_record_output(e);
+  if (metrics.enabled) {
+    metrics_count(e, len);
+    if (json_conf.metrics_interval > 0) metrics_summary();
+  }
+  if (record_queue != NULL) {
+    n = ATOMIC_LOAD(&(record_queue->dropped));
+    if (__atomic_exchange_n(&queue_dropped, n, __ATOMIC_ACQ_REL) < n) {
+      jlog("WARNING: json: %lu records dropped by queue overflow\n", n);
+    }
+  }
+  n = ATOMIC_LOAD(&(ring.toolarge));
+  if (__atomic_exchange_n(&ring_toolarge, n, __ATOMIC_ACQ_REL) < n) {
+    jlog("WARNING: json: %lu records too large for the ring\n", n);
+  }
+  json_init(e);
+  jlog("STAT: JSON: CALLBACK_EVENT_RECOGNITION_END\n");
 }
 
 
 /**
- * Register output functions to enable json output.
+ * Create the state of the plugin for @a recog, and add it to the list
+ * of engines.  Called with engine_mutex held.
+ */
+static JSONEngine *
+engine_new(Recog *recog)
+{
+  JSONEngine *e;
+  unsigned char *p;
+
+  e = (JSONEngine *)json_malloc(sizeof(JSONEngine));
+  memset(e, 0, sizeof(JSONEngine));
+  e->id = engine_num;
+  e->recog = recog;
+  if (IS_CBOR) {
+    p = (unsigned char *)e->tag;
+    memcpy(p, "\x66" "ENGINE", 7);
+    e->tag_len = 7 + cbor_head(p + 7, 0, e->id);
+  } else {
+    e->tag_len = sprintf(e->tag, "\"ENGINE\":%d", e->id);
+  }
+  charconv_open(&(e->conv));
+  json_init(e);
+  if (metrics.enabled) metrics_setup(e);
+
+  /* publish it complete to the metrics thread */
+  e->next = engine_root;
+  ATOMIC_STORE(&engine_root, e);
+  ATOMIC_STORE(&engine_num, engine_num + 1);
+  return e;
+}
+
+/**
+ * Register output functions to enable json output.  @a data is the
+ * engine state to give the callbacks; when NULL, a new one is made
+ * for @a recog.
  */
 void
 setup_output_json(Recog *recog, void *data)
 {
+  if (data == NULL) {
+    pthread_mutex_lock(&engine_mutex);
+    data = engine_new(recog);
+    pthread_mutex_unlock(&engine_mutex);
+  }
+  /* the trace hooks go first, to record what the callbacks below are given */
+  if (trace.fd >= 0) trace_setup(recog, data);
   //callback_add(recog, CALLBACK_EVENT_PROCESS_ONLINE, status_process_online, data);
   //callback_add(recog, CALLBACK_EVENT_PROCESS_OFFLINE, status_process_offline, data);
   //callback_add(recog, CALLBACK_EVENT_STREAM_BEGIN,     , data);
@@ -629,7 +5144,9 @@ setup_output_json(Recog *recog, void *data)
   callback_add(recog, CALLBACK_RESULT, result_pass2, data); // rejected, failed
   callback_add(recog, CALLBACK_RESULT_GMM, result_gmm, data);
   /* below will not be called if "-graphout" not specified */
-  //callback_add(recog, CALLBACK_RESULT_GRAPH, result_graph, data);
+  callback_add(recog, CALLBACK_RESULT_GRAPH, result_graph, data);
+  /* nor this if "-confnet" not specified */
+  callback_add(recog, CALLBACK_RESULT_CONFNET, result_confnet, data);
 
   //callback_add(recog, CALLBACK_EVENT_PAUSE, status_pause, data);
   //callback_add(recog, CALLBACK_EVENT_RESUME, status_resume, data);
@@ -638,12 +5155,86 @@ setup_output_json(Recog *recog, void *data)
   callback_add(recog, CALLBACK_EVENT_RECOGNITION_END, notify_recog_end, data);
 }
 
+/**
+ * Open the outputs shared by all engines, on the startup of the first
+ * one.  Called with engine_mutex held.
+ */
+static boolean
+json_start()
+{
+  if (json_conf.filename != NULL && json_conf.fd == STDOUT_FILENO) {
+    json_conf.fd = open(json_conf.filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (json_conf.fd < 0) {
+      jlog("ERROR: json: failed to open %s: %s\n", json_conf.filename, strerror(errno));
+      return FALSE;
+    }
+  }
+  if (json_conf.batch != NULL && batch.buf == NULL) {
+    /* records go to the shards instead of stdout, and tell their file */
+    if (json_conf.fd == STDOUT_FILENO && json_conf.filename == NULL) json_conf.fd = -1;
+    json_conf.fields |= FIELD(FIELD_SOURCE);
+    batch.buf = (char *)json_malloc(json_conf.batch_buffer);
+    atexit(batch_finish);
+  }
+  if (json_conf.trace != NULL && trace.fd < 0) {
+    if (! trace_open()) return FALSE;
+    atexit(trace_finish);
+  }
+  /* the prefix is only needed to pick records out of stdout */
+  if (json_conf.prefix < 0 || IS_CBOR) json_conf.prefix = (json_conf.fd == STDOUT_FILENO && ! IS_CBOR);
+  if (json_conf.compress != COMPRESS_NONE && cstream.method == COMPRESS_NONE) {
+    if (json_conf.fd < 0 || json_conf.fd == STDOUT_FILENO) {
+      jlog("ERROR: json: compress needs fd=N or file=path\n");
+      return FALSE;
+    }
+    json_conf.prefix = 0;
+    if (! cstream_start()) return FALSE;
+    /* registered before the queue, to run after it has drained */
+    atexit(cstream_finish);
+  }
+  if (json_conf.async > 0 && json_conf.fd >= 0 && record_queue == NULL) {
+    record_queue = record_queue_start(json_conf.async, json_conf.overflow);
+    if (record_queue == NULL) return FALSE;
+    atexit(record_queue_finish);
+  }
+  if (json_conf.unixpath != NULL || json_conf.tcpport > 0) {
+#ifdef HAVE_JSON_SERVER
+    if (server.epfd < 0 && ! server_start()) return FALSE;
+#else
+    jlog("ERROR: json: record server is not supported on this platform\n");
+    return FALSE;
+#endif
+  }
+  if (json_conf.shmpath != NULL && ring.hdr == NULL) {
+    if (! ring_open(json_conf.shmpath, json_conf.shmsize)) {
+      jlog("ERROR: json: failed to create ring %s: %s\n", json_conf.shmpath, strerror(errno));
+      return FALSE;
+    }
+  }
+  if ((json_conf.metrics != NULL || json_conf.metrics_interval > 0) && ! metrics.enabled) {
+    pthread_mutex_init(&(metrics.summary_mutex), NULL);
+    metrics.summary_time = json_clock();
+    metrics.enabled = TRUE;
+    if (json_conf.metrics != NULL && ! metrics_start()) return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * Called by Julius for each engine, with its Recog as @a data.
+ */
 int
 startup(void *data)
 {
   Recog *recog = data;
+  JSONEngine *e = NULL;
+
   if (outout_json_flag == 1) {
-    setup_output_json(recog, data);
+    pthread_mutex_lock(&engine_mutex);
+    if (json_start()) e = engine_new(recog);
+    pthread_mutex_unlock(&engine_mutex);
+    if (e == NULL) return -1;
+    setup_output_json(recog, e);
   }
   return 0;
 }